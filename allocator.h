@@ -7,6 +7,30 @@
 #include <limits>
 #include <cstdint>
 #include <cstring>
+#include <cstddef>
+#include <mutex>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <condition_variable>
+#include <tuple>
+#include <array>
+#include <type_traits>
+#include <memory>
+#include <algorithm>
+#include <string_view>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <cerrno>
+#include <system_error>
+
+// The system headers for file and shared memory regions are only included
+// by the implementation
+#if __has_include(<sys/mman.h>)
+  #define ALLOCATOR_HAS_MMAN
+#endif
 
 
 // To avoid duplicate function definitions if the header is included in multiple files,
@@ -23,14 +47,61 @@
 #endif
 
 
+// Calls fn (i) for every i in [0, count), spreading the calls over
+// the given number of threads (the calling thread included)
+// fn must not throw, as the calls may happen in other threads
+template <class Function>
+void parallel_for (size_t count, unsigned int threads, Function fn)
+  {
+  std::atomic<size_t> next (0);
+  auto work = [&]
+    {
+    for (auto i = next++; i < count; i = next++)
+      fn (i);
+    };
+
+  if (threads > count)
+    threads = count;
+  std::vector<std::thread> workers;
+  for (unsigned int i = 1; i < threads; i++)
+    workers.emplace_back (work);
+  work();
+  for (auto& worker : workers)
+    worker.join();
+  }
+
+
 // Handles constructing/destruction our cache,
 // maintaining the addresses needed by the allocator
 class Allocator_cache
   {
   public:
 
-  static Allocator_cache* construct (size_t, Allocator_cache* = nullptr);
+  // The memory of the cache is zeroed if the last argument is set
+  static Allocator_cache* construct (size_t, Allocator_cache* = nullptr, bool = false);
+  // Constructs a cache in the given memory, which is not owned by the cache:
+  // it must not be passed to destruct()
+  static Allocator_cache* construct_in (void*, size_t);
+  // Constructs a cache header in header, for the given memory: unlike
+  // construct_in(), the memory holds nothing but the objects
+  // Neither is owned by the cache, which must not be passed to destruct()
+  static Allocator_cache* construct_over (void* header, void* memory, size_t);
   static void destruct (Allocator_cache*);
+  // Bytes of memory needed for a cache with sizeof_cache bytes available
+  static constexpr size_t size_for (size_t sizeof_cache);
+  // Size of a CPU cache line: the memory available for allocations starts
+  // on a fresh line, so that the header (written by every allocation)
+  // doesn't share a line with the first objects, read by other threads
+  static constexpr size_t line_size = 64;
+  // Bytes available for allocations in this cache
+  size_t capacity() const;
+  // Shared cache with no space in it, used by allocators that haven't
+  // allocated anything yet: the first create() always rolls over from it
+  // Its pointers are null, so free space is checked as end - cursor
+  static Allocator_cache* empty();
+  // Empties the cache, and unlinks the following ones
+  // The data is not modified, but the dead bitmap is freed
+  void reset();
   
   // Start of the memory available for allocations
   char *start;
@@ -38,51 +109,659 @@ class Allocator_cache
   void *end;
   // Address of the previous cache
   Allocator_cache *previous;
+  // Address of the next cache, used to visit the caches in allocation order
+  Allocator_cache *next;
   // Position of the curson in the current cache
   char *cursor;
+  // Start of the most recent allocation, or start if there is none
+  // Only maintained by Generic_allocator, to walk its objects backwards
+  char *last;
+  // Bitmap of the objects destroyed individually by Allocator::destroy(),
+  // one bit per object; nullptr until the first one
+  uint64_t *dead;
 
   private:
 
   // Really should be constexpr, but can't since it needs to be defined inline,
   // and also after the class is fully defined
   static const size_t sizeof_this;
+  static Allocator_cache empty_cache;
+
+  // Start of the memory available for allocations, for a cache at addr
+  static char* data_start (char* addr);
   
   // Hidden constructor: allocation should only be handled by ::construct()
   Allocator_cache (char*, size_t, Allocator_cache*);
+  // Constructor for construct_over()
+  Allocator_cache (char* start, size_t);
+  // Constructor for empty_cache, constexpr so that it's constant-initialized
+  // before any allocator, whatever the order of static initialization
+  constexpr Allocator_cache();
+  };
+
+// Bytes taken by the header, and the padding needed to align start on a
+// cache line, for memory aligned for any fundamental type (as from malloc())
+constexpr size_t Allocator_cache :: sizeof_this =
+  (sizeof(Allocator_cache) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t)
+  + line_size - alignof(std::max_align_t);
+
+constexpr size_t Allocator_cache :: size_for (size_t sizeof_cache)
+  { return sizeof_cache + sizeof_this; }
+
+// The empty cache has no memory at all
+constexpr Allocator_cache :: Allocator_cache() :
+  start (nullptr),
+  end (nullptr),
+  previous (nullptr),
+  next (nullptr),
+  cursor (nullptr),
+  last (nullptr),
+  dead (nullptr)
+  {  }
+
+inline Allocator_cache* Allocator_cache :: empty()
+  { return &empty_cache; }
+
+inline size_t Allocator_cache :: capacity() const
+  { return (char*)end - start; }
+
+inline void Allocator_cache :: reset()
+  {
+  cursor = last = start;
+  next = nullptr;
+  free (dead);
+  dead = nullptr;
+  }
+
+// Background thread freeing the caches released by clear_async(),
+// so that the calling thread doesn't pay for free()
+// The thread is started by the first release()
+class Allocator_reclaimer
+  {
+  public:
+
+  // Hands the given caches (linked through next) over to the reclaimer
+  static void release (Allocator_cache*);
+  // Waits until all the caches released so far have been freed
+  static void drain();
+
+  private:
+
+  std::mutex mutex;
+  // Signals the thread that there are caches to free, or that it should stop
+  std::condition_variable wake;
+  // Signals drain() that the thread is idle
+  std::condition_variable idle;
+  std::vector<Allocator_cache*> pending;
+  bool busy = false;
+  bool stop = false;
+  std::thread thread;
+
+  Allocator_reclaimer();
+  ~Allocator_reclaimer();
+  static Allocator_reclaimer& instance();
+  void run();
+  };
+
+// Contiguous range of memory for the objects of a Region_allocator, so
+// that they can be addressed by 32-bit offsets from its base (Arena_ptr)
+// Where available, the range is only reserved up front: the OS backs its
+// pages with memory once they are used
+// The region starts with a header, recording how much of it is used
+// The region holds no pointers of its own, so that it can be mapped at
+// different addresses, by different runs or processes
+class Allocator_region
+  {
+  public:
+  struct shared_memory_t {  };
+  static constexpr shared_memory_t shared_memory {};
+
+  // size is at most 4 GB, the range of the offsets, and at least the
+  // size of the header
+  explicit Allocator_region (size_t size);
+#ifdef ALLOCATOR_HAS_MMAN
+  // Maps the file at path, created or grown to size bytes if needed, so
+  // that the objects persist across runs: a Region_allocator on a region
+  // of an existing file finds the objects left there
+  // Only objects that are trivially copyable, and refer to each other with
+  // Arena_ptrs, can be reopened
+  // Throws std::system_error if the file can't be opened or mapped, and
+  // EINVAL if it holds something other than a region (which is left as is)
+  Allocator_region (const char* path, size_t size);
+  // Maps the POSIX shared memory object name ("/name"), created or grown
+  // to size bytes if needed, so that a producer process can build objects
+  // for consumer processes to map without copying
+  // A read_only region must already hold a region of at least size bytes:
+  // its Region_allocator can iterate over the objects, synced by the
+  // producer, but not create any (create() throws std::bad_alloc) nor
+  // clear() them (clear() does nothing)
+  // Same objects and errors as for files
+  Allocator_region (shared_memory_t, const char* name, size_t size, bool read_only = false);
+  // Removes the shared memory object name, once mapped by all processes
+  static void unlink_shared (const char* name);
+#endif
+  ~Allocator_region();
+  Allocator_region (const Allocator_region&) = delete;
+  Allocator_region& operator= (const Allocator_region&) = delete;
+
+  char* base() const;
+  size_t size() const;
+  // Offset of addr, which must be in the region, from base()
+  uint32_t offset_of (const void* addr) const;
+  void* address_of (uint32_t offset) const;
+
+  // Memory after the header, for the allocator's objects
+  char* data() const;
+  size_t data_size() const;
+  // Bytes of the cache used by objects, as last recorded by the allocator
+  size_t used() const;
+  void set_used (size_t);
+  // Distance between the objects, as recorded by the allocator (0 if none)
+  size_t stride() const;
+  void set_stride (size_t);
+  // Whether the region is backed by a file or shared memory object
+  bool persistent() const;
+  bool read_only() const;
+  // Writes the region back to its file, if any
+  void flush();
+
+  private:
+  struct Header
+    {
+    uint64_t magic;
+    uint64_t used;
+    uint64_t stride;
+    };
+  // Reads "AREGION" in a little-endian file
+  static constexpr uint64_t magic = 0x4e4f4947455241ULL;
+  static constexpr size_t sizeof_header = Allocator_cache::line_size;
+
+  char *memory;
+  size_t sizeof_region;
+  bool file_backed = false;
+  bool writable = true;
+
+  Header* header() const;
+  // Sets up the header of a fresh region, or checks an existing one,
+  // returning false if it isn't valid
+  bool open_header (bool fresh);
+#ifdef ALLOCATOR_HAS_MMAN
+  // Maps size bytes of the file fd, and closes it
+  // Only an empty file, or a smaller region, is grown, unless the region
+  // is read-only; returns whether the file was empty
+  bool map_file (int fd, size_t size);
+#endif
   };
 
-constexpr size_t Allocator_cache :: sizeof_this = sizeof(Allocator_cache) + alignof(Allocator_cache);
+inline char* Allocator_region :: base() const
+  { return memory; }
+
+inline size_t Allocator_region :: size() const
+  { return sizeof_region; }
+
+inline uint32_t Allocator_region :: offset_of (const void* addr) const
+  { return (uint32_t)((const char*)addr - memory); }
+
+inline void* Allocator_region :: address_of (uint32_t offset) const
+  { return memory + offset; }
+
+inline char* Allocator_region :: data() const
+  { return memory + sizeof_header; }
+
+inline size_t Allocator_region :: data_size() const
+  { return sizeof_region - sizeof_header; }
+
+inline size_t Allocator_region :: used() const
+  { return header()->used; }
+
+inline void Allocator_region :: set_used (size_t used)
+  { header()->used = used; }
+
+inline size_t Allocator_region :: stride() const
+  { return header()->stride; }
+
+inline void Allocator_region :: set_stride (size_t stride)
+  { header()->stride = stride; }
+
+inline bool Allocator_region :: persistent() const
+  { return file_backed; }
+
+inline bool Allocator_region :: read_only() const
+  { return !writable; }
+
+inline auto Allocator_region :: header() const -> Header*
+  { return (Header*)memory; }
 
 class Allocator_base
   {
   public:
   
-  unsigned int cache_size = 2048;
+  // Size of the first cache, allocated by the first create()
+  size_t first_cache_size = 2048;
+  // Size of the caches allocated when the current one is full
+  // Changing it only affects the caches allocated afterwards
+  size_t cache_size = 2048;
+  // If set, the caches allocated from then on are zeroed, and clear()
+  // zeroes the memory used in the first cache before reusing it
+  // Cheaper than zeroing each object: the memory comes from calloc(),
+  // which can skip zeroing fresh pages from the OS, and is otherwise
+  // cleared in bulk
+  bool zero_caches = false;
   virtual ~Allocator_base() = 0;
 
   virtual void clear() = 0;
 
   protected:
+
+  Allocator_base() = default;
+  Allocator_base (size_t first_cache_size, size_t cache_size);
   
   // The data cache currently in use
-  Allocator_cache *cache;
+  // No memory is allocated until the first create(): until then,
+  // this points to Allocator_cache::empty()
+  Allocator_cache *cache = Allocator_cache::empty();
+  // The oldest cache in the chain, kept around by clear()
+  Allocator_cache *first = Allocator_cache::empty();
+  // Copies of cache->cursor and cache->end, so that the fast path of
+  // Allocator::create() doesn't need to load them through cache
+  // While in use, cache->cursor is out of date until save_cursor()
+  char *cursor = Allocator_cache::empty()->start;
+  char *limit = Allocator_cache::empty()->start;
+
+  // Writes cursor back to the current cache, before the caches are read
+  // The shared empty cache is never written, as other threads may read it
+  void save_cursor()
+    {
+    if (cache != Allocator_cache::empty())
+      cache->cursor = cursor;
+    }
+  // End of the objects of the given cache, for the const readers that
+  // can't save_cursor()
+  char* cursor_of (const Allocator_cache* c) const
+    { return c == cache ? cursor : c->cursor; }
+  // Loads cursor and limit from the current cache, after it changed
+  void load_cursor()
+    {
+    cursor = cache->cursor;
+    limit = (char*)cache->end;
+    }
+
+  // Replaces the current cache with a new one of sizeof_cache bytes
+  // (first_cache_size if there is no cache yet), which must have room
+  // for sizeof_needed bytes
+  // Kept out of line, as it's only reached when the current cache is full
+  void next_cache (size_t sizeof_cache, size_t sizeof_needed);
+  // Makes sure the current cache has sizeof_needed free bytes, replacing it
+  // with a single cache of at least that size if it doesn't
+  void reserve_cache (size_t sizeof_needed);
+  // Links other's cache chain on top of ours, so that its objects
+  // become owned by this allocator; other is left empty
+  void splice_chain (Allocator_base& other);
+  // The caches in allocation order, starting with first
+  std::vector<Allocator_cache*> list_caches() const;
+  // Frees all the given caches (from list_caches()) but the first one,
+  // from the given number of threads, and makes the first one current again
+  // The objects must already have been destroyed
+  void release_caches (const std::vector<Allocator_cache*>& caches, unsigned int threads);
+  // Unlinks all the caches but the first one and makes the first one
+  // current again, returning the unlinked caches (linked through next)
+  Allocator_cache* detach_caches();
+  // Makes the first cache current again, and empties it
+  void reset_first();
+
+  private:
+
+  // Makes a new cache of sizeof_cache bytes the current one
+  void push_cache (size_t sizeof_cache);
+  };
+
+
+// Growth policies: size of the next cache, given the capacity of the
+// current one (0 if there is none) and the allocator's cache size
+// Every cache has the same size
+struct Fixed_growth
+  {
+  static constexpr size_t next (size_t, size_t cache_size)
+    { return cache_size; }
+  };
+
+// Every cache is twice the size of the previous one, so that the number
+// of caches grows logarithmically with the number of objects
+struct Doubling_growth
+  {
+  static constexpr size_t next (size_t current, size_t cache_size)
+    { return current < cache_size ? cache_size : current * 2; }
+  };
+
+// Thread policies: the lock taken by create(), clear() and splice()
+// No_lock compiles to nothing, for allocators used by a single thread
+struct No_lock
+  {
+  void lock() {  }
+  void unlock() {  }
+  };
+
+using Mutex_lock = std::mutex;
+
+// Compile-time configuration of Allocator
+// Cache_size: size of the caches in bytes, 0 to use the runtime
+//   Allocator_base::cache_size instead
+// Growth: growth policy, see Fixed_growth
+// Alignment: minimum alignment of the objects, 0 to use alignof(Object)
+//   Can be used to put each object in its own cache line, for example
+// Lock: thread policy, see No_lock
+template <size_t Cache_size = 0, class Growth = Fixed_growth, size_t Alignment = 0, class Lock = No_lock>
+struct Allocator_policy
+  {
+  static constexpr size_t cache_size = Cache_size;
+  static constexpr size_t alignment = Alignment;
+  using growth = Growth;
+  using lock = Lock;
   };
 
 
+template <class Object, size_t Inline_size, class Policy>
+class Inline_allocator;
+template <class Object, class Policy>
+class Region_allocator;
+
 // This class contains the homogeneous implementation
 // (allows for a single data class)
-template <class Object>
+template <class Object, class Policy = Allocator_policy<>>
 class Allocator : public Allocator_base
   {
-  static constexpr auto sizeof_obj = sizeof(Object) + alignof(Object);
+  static constexpr size_t alignment = Policy::alignment > alignof(Object) ? Policy::alignment : alignof(Object);
+  static_assert (alignment <= Allocator_cache::line_size, "Allocator error: alignment exceeds the alignment of caches");
+  static_assert ((alignment & (alignment - 1)) == 0, "Allocator error: alignment is not a power of two");
+
+  // Distance between two consecutive objects
+  static constexpr size_t sizeof_obj = (sizeof(Object) + alignment - 1) / alignment * alignment;
+  static_assert (Policy::cache_size == 0 || sizeof_obj <= Policy::cache_size, "Allocator error: object exceeds cache size");
+  static constexpr size_t default_cache_size = Policy::cache_size != 0 ? Policy::cache_size : 2048;
   
   public:
   Allocator();
+  // Sizes of the first cache and of the following ones, in bytes
+  // An allocator sized to the expected working set never needs a second cache
+  explicit Allocator (size_t first_cache_size, size_t cache_size = 2048);
   ~Allocator();
 
   template <class ... Args>
   Object* create (Args&& ... args);
+  // Destroys all the objects, in reverse allocation order, and frees
+  // all the caches but the first one
+  void clear() override;
+  // Makes room for count objects in the current cache, so that the
+  // next count calls to create() won't need to allocate memory
+  void reserve (size_t count);
+
+  // Iteration over the allocated objects, in allocation order
+  // Objects created while iterating may or may not be visited
+  template <class Value>
+  class basic_iterator;
+  using iterator = basic_iterator<Object>;
+  using const_iterator = basic_iterator<const Object>;
+
+  iterator begin();
+  iterator end();
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  // Calls fn (Object&) on every object, in allocation order
+  // Faster than iterators, as objects are visited one cache at a time
+  template <class Function>
+  void for_each (Function fn);
+  // Calls fn (Object* first, Object* last) on each cache's range of objects,
+  // in allocation order
+  // Only available if the objects are contiguous (no padding added by Policy)
+  template <class Function>
+  void for_each_range (Function fn);
+  // Calls fn (Object&) on every object, from the given number of threads
+  // Objects are split in blocks of about parallel_grain bytes, so that
+  // large caches are shared among threads too
+  // The order of the calls is unspecified, and fn must not throw
+  template <class Function>
+  void parallel_for_each (Function fn, unsigned int threads = std::thread::hardware_concurrency());
+
+  static constexpr size_t parallel_grain = 64 * 1024;
+
+  // Same as clear(), but destroys the objects and frees the caches from
+  // the given number of threads, in unspecified order
+  // Object's destructor must not throw
+  void parallel_clear (unsigned int threads = std::thread::hardware_concurrency());
+  // Same as clear(), but the caches are freed by the Allocator_reclaimer
+  // thread: only the destructors are called by the calling thread
+  void clear_async();
+
+  // Takes ownership of all objects allocated by other, in O(1):
+  // no object is moved, other's caches are linked into this allocator
+  // and will be destroyed by it
+  void splice (Allocator&& other);
+  // Part of an Inline_allocator's objects live inside the allocator itself,
+  // so they can't be handed over
+  template <size_t Inline_size>
+  void splice (Inline_allocator<Object, Inline_size, Policy>&& other) = delete;
+  // Same for a Region_allocator, whose cache belongs to its region
+  void splice (Region_allocator<Object, Policy>&& other) = delete;
+
+  // Compact reference to an object, resolved by get() in O(1)
+  // Handles stay valid until clear(), including across splice() into
+  // this allocator, but not when this allocator is spliced into another
+  struct Handle
+    {
+    uint32_t index;
+    };
+
+  // Same as create(), returning a handle to the object
+  template <class ... Args>
+  Handle create_handle (Args&& ... args);
+  Object* get (Handle handle) const;
+
+  // Destroys a single object, whose memory stays unused until compact()
+  // or clear(); iteration and clear() skip it from then on
+  // Finds the object's cache by walking back from the newest one, so
+  // destroying recent objects is fastest
+  void destroy (Object* obj);
+  // Moves the remaining objects towards the first cache, in allocation
+  // order, so that they fill the memory left by destroy(), and frees
+  // the caches left empty
+  // Calls fn (Object* from, Object* to) after each object is moved, to
+  // update the references to it: pointers and handles to moved objects
+  // are invalidated
+  template <class Function>
+  void compact (Function fn);
+
+  // Writes all the objects to out as one flat image, in allocation order
+  // Only for trivially copyable Objects; the objects are left in place
+  void snapshot (std::ostream& out) const;
+  // Replaces the objects with those of an image written by snapshot(),
+  // read with a single read into a single cache if in can seek; otherwise
+  // in chunks of restore_chunk bytes, so that a corrupt count runs into the
+  // end of the stream rather than into a huge allocation
+  // Returns false, leaving the allocator empty, if in isn't a valid image
+  bool restore (std::istream& in);
+
+  private:
+
+  // Start of the images written by snapshot()
+  struct Image_header
+    {
+    uint64_t magic;
+    uint64_t sizeof_obj;
+    uint64_t count;
+    };
+  // Reads "AIMAGE" in a little-endian image
+  static constexpr uint64_t image_magic = 0x45474d414941ULL;
+  static constexpr size_t restore_chunk = 1024 * 1024;
+
+  typename Policy::lock lock;
+
+  // Checks the stride of the objects found in its region
+  friend class Region_allocator<Object, Policy>;
+
+  // Whether the object at pos, in the given cache, was destroyed by destroy()
+  static bool is_dead (const Allocator_cache*, const char* pos);
+
+  // Handles index a directory of pages of page_size consecutive objects:
+  // a page is a slot of the directory, holding the address of its first
+  // object. Each cache starts on a new page
+  static constexpr unsigned int page_bits = 6;
+  static constexpr size_t page_size = size_t (1) << page_bits;
+  // Filled lazily by create_handle(), up to directory_cache
+  std::vector<char*> directory;
+  Allocator_cache *directory_cache = nullptr;
+  // Index of the first object of directory_cache
+  uint32_t directory_base = 0;
+
+  // Adds the caches created since the last call to the directory
+  void sync_directory();
+  void reset_directory();
+
+  template <class Value>
+  basic_iterator<Value> make_iterator() const;
+  // Calls the destructor of every object in the given cache
+  static void destroy_objects (Allocator_cache*);
+
+  // Compile-time constant, unless Policy::cache_size is 0
+  size_t sizeof_cache() const;
+
+  // Moves to a new cache when the current one is full
+  void roll_over();
+  };
+
+
+template <class Object, class Policy>
+template <class Value>
+class Allocator<Object, Policy>::basic_iterator
+  {
+  public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = Object;
+  using difference_type = ptrdiff_t;
+  using pointer = Value*;
+  using reference = Value&;
+
+  basic_iterator() = default;
+  // Allows converting an iterator to a const_iterator
+  template <class Other>
+  basic_iterator (const basic_iterator<Other>& other);
+
+  reference operator* () const;
+  pointer operator-> () const;
+  basic_iterator& operator++ ();
+  basic_iterator operator++ (int);
+  template <class Other>
+  bool operator== (const basic_iterator<Other>& other) const;
+  template <class Other>
+  bool operator!= (const basic_iterator<Other>& other) const;
+
+  private:
+  template <class>
+  friend class basic_iterator;
+  friend class Allocator;
+
+  // The end iterator has no cache
+  Allocator_cache *cache = nullptr;
+  char *pos = nullptr;
+  // The allocator's current cache, whose cursor is only up to date in
+  // the allocator: its end is taken when the iteration starts
+  const Allocator_cache *current = nullptr;
+  char *current_cursor = nullptr;
+
+  basic_iterator (Allocator_cache* first, const Allocator_cache* current, char* current_cursor);
+  // End of the objects of cache
+  char* cache_cursor() const;
+  // Moves to the first object of the next non-empty cache
+  void skip_empty();
+  // Moves past the objects destroyed by destroy()
+  void skip_dead();
+  };
+
+
+// Allocator that keeps its first cache inside the allocator object,
+// with room for Inline_size bytes of Objects
+// No heap allocation happens until that space is used up, so short-lived
+// allocators on the stack can avoid the heap entirely
+template <class Object, size_t Inline_size, class Policy = Allocator_policy<>>
+class Inline_allocator : public Allocator<Object, Policy>
+  {
+  public:
+  // The inline cache is allocated with the allocator: zero_caches must be
+  // passed here for it to be zeroed
+  explicit Inline_allocator (bool zero_caches = false);
+  ~Inline_allocator();
+
+  private:
+  alignas(Allocator_cache::line_size) char storage[Allocator_cache::size_for (Inline_size)];
+  };
+
+
+// Allocator whose single cache spans an Allocator_region, so that its
+// objects can refer to each other with 32-bit Arena_ptrs instead of pointers
+// Once the region is full, create() throws std::bad_alloc
+// The region must outlive the allocator, and be used by a single allocator
+// (per process, for a shared region, of which only one may be writable)
+// The objects already in the region (when reopening a persistent region)
+// belong to the allocator, and those of a persistent region are kept,
+// not destroyed, by the allocator's destructor
+// Throws std::system_error (EINVAL) if the region holds objects of another
+// size
+template <class Object, class Policy = Allocator_policy<>>
+class Region_allocator : public Allocator<Object, Policy>
+  {
+  public:
+  explicit Region_allocator (Allocator_region&);
+  ~Region_allocator();
+
+  // Records the objects in the region's header, and flushes the region
+  // Only needed to save a file-backed region before the destructor runs,
+  // or to publish the objects of a shared one to its consumers
+  // Does nothing for a read-only region
+  void sync();
+
+  // Does nothing on a read-only region, whose objects belong to its producer
   void clear() override;
+
+  // Heap caches can't be added to the region
+  void splice (Allocator<Object, Policy>&& other) = delete;
+  void reserve (size_t count) = delete;
+  bool restore (std::istream& in) = delete;
+  // The objects destroyed by destroy() are recorded on the heap, so they
+  // would come back when reopening the region; compact() would move objects
+  // behind the Arena_ptrs referring to them
+  void destroy (Object* obj) = delete;
+  template <class Function>
+  void compact (Function fn) = delete;
+  // The region's cache is not on the heap, and there is only one to clear
+  void parallel_clear (unsigned int threads) = delete;
+  void clear_async() = delete;
+
+  private:
+  Allocator_region *region;
+  // Header of the region's cache, kept out of the region as its pointers
+  // are only valid in this process
+  alignas(Allocator_cache) char cache_header[sizeof(Allocator_cache)];
+  };
+
+// 32-bit reference to an Object in an Allocator_region, half the size
+// of a pointer
+// Resolving it needs the region; the null Arena_ptr has offset 0, where
+// no object can be as the region starts with its header
+template <class Object>
+class Arena_ptr
+  {
+  public:
+  Arena_ptr() = default;
+  Arena_ptr (const Allocator_region&, Object*);
+
+  Object* get (const Allocator_region&) const;
+  uint32_t offset() const;
+  explicit operator bool() const;
+  bool operator== (const Arena_ptr& other) const;
+  bool operator!= (const Arena_ptr& other) const;
+
+  private:
+  uint32_t value = 0;
   };
 
 
@@ -105,6 +784,10 @@ class Obj_wrapper
   {
   public:
   const uint8_t sizeof_obj;
+  // Bytes between the previous wrapper in the same cache and this one
+  // Fits in the padding before destructor_ptr
+  const uint32_t sizeof_previous;
+  // nullptr for raw memory blocks, which have no destructor
   const void_fn_ptr destructor_ptr;
 
   // Requires an Object* as it's the only way to communicate
@@ -112,7 +795,9 @@ class Obj_wrapper
   //It isn't used (it's enough to pass a nullptr cast to the Obj type)
   // and should be optimized out by the compiler
   template <class Obj, class ... Args>
-  Obj_wrapper (Obj*, Args&& ... args);
+  Obj_wrapper (Obj*, uint32_t sizeof_previous, Args&& ... args);
+  // Wrapper of a raw memory block, see Generic_allocator::allocate()
+  explicit Obj_wrapper (uint32_t sizeof_previous);
   ~Obj_wrapper();
 
   void* obj_ptr();
@@ -120,168 +805,2526 @@ class Obj_wrapper
 
 // This is the generic implementation
 // Allows allocation of any class (as long as
-// it fits in the cache_size)
+// it fits in the caches)
 // Has a slight performance penalty, as it requires to
 // store a pointer to the destructor of each object
 // and the size of the object
 class Generic_allocator : public Allocator_base
   {
   static constexpr auto sizeof_wrapper = sizeof(Obj_wrapper) + alignof(Obj_wrapper);
+  // Rounds a record's size up, so that every wrapper stays aligned
+  static constexpr size_t align_record (size_t sizeof_record);
+  // Bytes used by an Object and its wrapper
+  template <class Object>
+  static constexpr size_t sizeof_record = align_record (sizeof_wrapper + sizeof(Object) + alignof(Object));
   
   public:
+  // Alignment of the memory returned by allocate()
+  static constexpr size_t alignment = alignof(Obj_wrapper);
+
   Generic_allocator();
+  // See Allocator::Allocator (size_t, size_t)
+  explicit Generic_allocator (size_t first_cache_size, size_t cache_size = 2048);
   ~Generic_allocator();
 
   template <class Object, class ... Args>
   Object* create (Args&& ... args);
+  // See Allocator::clear()
   void clear() override;
+  // See Allocator::parallel_clear()
+  // Each cache is handled by a single thread
+  void parallel_clear (unsigned int threads = std::thread::hardware_concurrency());
+  // See Allocator::clear_async()
+  void clear_async();
+  // Makes room for the given amount of bytes, or of count Objects,
+  // see Allocator::reserve()
+  void reserve (size_t bytes);
+  template <class Object>
+  void reserve (size_t count);
+
+  // Takes ownership of all objects allocated by other, see Allocator::splice()
+  void splice (Generic_allocator&& other);
+
+  // Allocates bytes of uninitialized memory, aligned to alignment
+  // Nothing is destroyed there by clear(), which only releases the memory
+  // Blocks bigger than cache_size get a cache of their own
+  void* allocate (size_t bytes);
+  // Grows the given block by bytes, in place, if it's the most recent
+  // allocation and its cache has room left
+  // Returns false, leaving the block unchanged, otherwise
+  bool extend (void* block, size_t bytes);
+
+  private:
+
+  // Calls the destructor of every object in the given cache
+  static void destroy_objects (Allocator_cache*);
   };
 
+constexpr size_t Generic_allocator :: align_record (size_t sizeof_record)
+  { return (sizeof_record + alignof(Obj_wrapper) - 1) / alignof(Obj_wrapper) * alignof(Obj_wrapper); }
 
 
+// Vector whose elements live in a Generic_allocator
+// When the vector's storage is the allocator's most recent allocation,
+// growing it just extends it in place, without copying the elements:
+// vectors filled one at a time never copy them
+// Storage abandoned by a reallocation is only released by the allocator's
+// clear(), and the vector must not be used after it
 template <class Object>
-Allocator<Object> :: Allocator() :
-  Allocator_base()
-  { cache = Allocator_cache::construct (cache_size); }
+class Arena_vector
+  {
+  static_assert (alignof(Object) <= Generic_allocator::alignment, "Arena_vector error: alignment exceeds the alignment of allocations");
 
-template <class Object>
-Allocator<Object> :: ~Allocator()
-  { clear(); }
+  public:
+  using value_type = Object;
+  using iterator = Object*;
+  using const_iterator = const Object*;
 
-template <class Object>
-template <class ... Args>
-Object* Allocator<Object> :: create (Args&& ... args)
+  explicit Arena_vector (Generic_allocator&);
+  ~Arena_vector();
+  Arena_vector (const Arena_vector&) = delete;
+  Arena_vector& operator= (const Arena_vector&) = delete;
+
+  template <class ... Args>
+  Object& emplace_back (Args&& ... args);
+  void push_back (const Object&);
+  void push_back (Object&&);
+  void pop_back();
+  // Destroys all the elements, keeping the storage
+  void clear();
+  // Makes room for min_capacity elements
+  void reserve (size_t min_capacity);
+
+  size_t size() const;
+  size_t capacity() const;
+  bool empty() const;
+  Object* data();
+  const Object* data() const;
+  Object& operator[] (size_t);
+  const Object& operator[] (size_t) const;
+  Object& back();
+  const Object& back() const;
+
+  iterator begin();
+  iterator end();
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  private:
+  Generic_allocator *allocator;
+  Object *elements = nullptr;
+  size_t count = 0;
+  size_t capacity_ = 0;
+
+  // Grows the storage to hold at least min_capacity elements
+  void grow (size_t min_capacity);
+  };
+
+
+// Immutable, null-terminated string whose characters live in a
+// Generic_allocator
+// Copying it only copies the reference to the characters, which are
+// released by the allocator's clear()
+class Arena_string
   {
-  if (sizeof_obj > cache_size)
-    throw_or_abort (std::bad_alloc());
-  
-  if (cache->cursor + sizeof_obj >= cache->end)
-    cache = Allocator_cache::construct (cache_size, cache);
-  
-  // Placement new: allocates Object in place avoiding unnecessary memory movements
-  auto tmp = new (cache->cursor) Object (std::forward<Args> (args)...);
-  cache->cursor += sizeof_obj;
-  return tmp;
-  }
+  public:
+  Arena_string() = default;
+  Arena_string (Generic_allocator&, std::string_view);
 
-template <class Object>
-void Allocator<Object> :: clear()
+  const char* data() const;
+  const char* c_str() const;
+  size_t size() const;
+  bool empty() const;
+  std::string_view view() const;
+  operator std::string_view() const;
+
+  // Compares the characters, see String_interner for faster comparisons
+  bool operator== (const Arena_string&) const;
+  bool operator!= (const Arena_string&) const;
+
+  private:
+  friend class String_interner;
+
+  const char *chars = "";
+  size_t length = 0;
+
+  Arena_string (const char* chars, size_t length);
+  };
+
+// Table of unique strings, whose characters live in a Generic_allocator
+// Interning equal strings returns the same characters: interned strings
+// can be compared by data() alone, and duplicates take no extra memory
+// The characters of many strings are packed in the same allocations
+// The table itself is on the heap, and must not be used after the
+// allocator's clear()
+class String_interner
   {
-  // Delete all Allocator_cache instances, save for the original one
-  while (true)
+  public:
+  explicit String_interner (Generic_allocator&);
+  String_interner (const String_interner&) = delete;
+  String_interner& operator= (const String_interner&) = delete;
+
+  // The interned copy of str, made on the first call for its characters
+  Arena_string intern (std::string_view str);
+  // Number of unique strings
+  size_t size() const;
+
+  private:
+  struct Slot
     {
-    // Call the destructor for the allocated objects
-    for (auto pos = cache->start; pos != cache->cursor; pos += sizeof_obj)
-      ((Object*)pos)->~Object();
+    size_t hash = 0;
+    Arena_string string = Arena_string (nullptr, 0);
+    };
 
-    if (cache->previous == nullptr)
-      break;
-    else
-      {
-      auto tmp = cache->previous;
-      Allocator_cache::destruct (cache);
-      cache = tmp;
-      }
-    }
-  // Reset the original instance
-  // The data is not modified, and Objects allocated in the first
-  // cache will remain accessible (to avoid this, we could reallocate or
-  // overwrite the original cache as well, at a small performance cost)
-  cache->cursor = cache->start;
-  }
+  // Size of the allocations the characters are packed in
+  static constexpr size_t sizeof_block = 4096;
 
+  Generic_allocator *allocator;
+  // Open addressing with linear probing; empty slots have a null string
+  // Kept at most half full, and its size a power of two
+  std::vector<Slot> slots;
+  size_t count = 0;
+  // Current block of characters, and its free part
+  char *block = nullptr;
+  char *block_cursor = nullptr;
+  char *block_end = nullptr;
 
-template <class Object, class ... Args>
-Object* Generic_allocator :: create (Args&& ... args)
+  // Copies str, null-terminated, into the current block
+  const char* store (std::string_view str);
+  void rehash (size_t sizeof_slots);
+  };
+
+// Hash map whose table lives in a Generic_allocator, for maps that are
+// built, used, and then discarded all at once with the allocator's clear()
+// Entries are stored in the table itself (open addressing with linear
+// probing), so inserting doesn't allocate a node per entry
+// Tables abandoned when growing are only released by clear(), and growing
+// moves the entries: inserting a new key invalidates the pointers to them
+// Entries can't be erased; the map must not be used after clear()
+template <class Key, class Value, class Hash = std::hash<Key>, class Equal = std::equal_to<Key>>
+class Arena_hash_map
   {
-  auto sizeof_obj     = sizeof(Object)      + alignof(Object);
-  if (sizeof_wrapper + sizeof_obj > cache_size)
-    throw_or_abort (std::bad_alloc());
-  
-  if (cache->cursor + sizeof_wrapper + sizeof_obj >= cache->end)
-    cache = Allocator_cache::construct (cache_size, cache);
-  
-  auto tmp = new (cache->cursor) Obj_wrapper ((Object*)nullptr, std::forward<Args> (args)...);
-  cache->cursor += sizeof_wrapper + sizeof_obj;
-  return (Object*)tmp->obj_ptr();
-  }
+  // hash is 0 for empty slots
+  struct Slot
+    {
+    size_t hash;
+    Key key;
+    Value value;
+    };
+  static_assert (alignof(Slot) <= Generic_allocator::alignment, "Arena_hash_map error: alignment exceeds the alignment of allocations");
 
+  public:
+  explicit Arena_hash_map (Generic_allocator&);
+  ~Arena_hash_map();
+  Arena_hash_map (const Arena_hash_map&) = delete;
+  Arena_hash_map& operator= (const Arena_hash_map&) = delete;
 
-template <class Obj, class ... Args>
-Obj_wrapper :: Obj_wrapper (Obj*, Args&& ... args) :
-  sizeof_obj (sizeof(Obj) + alignof (Obj)),
-  destructor_ptr (destructor_wrapper<Obj>)
-  {
-  // Check that the object's size is not bigger than what our size variable allows for
-  static_assert (sizeof(Obj) + alignof (Obj) <= std::numeric_limits<uint8_t>::max(), "Generic_allocator error: object exceeds maxiumum size");
-  new (obj_ptr()) Obj (std::forward<Args>(args)...);
-  }
+  // Inserts Value (args...) for key, unless key is already there
+  // Returns the value for key, and whether it was inserted
+  template <class ... Args>
+  std::pair<Value*, bool> emplace (const Key& key, Args&& ... args);
+  // Value for key, default-constructed and inserted if key isn't there
+  Value& operator[] (const Key& key);
+  // Value for key, or nullptr if key isn't there
+  Value* find (const Key& key);
+  const Value* find (const Key& key) const;
 
+  size_t size() const;
+  bool empty() const;
+  // Makes room for the given number of entries, so that inserting them
+  // won't grow the table
+  void reserve (size_t entries);
 
-// All non template functiond definitions are in this ifdef'd area.
-#ifdef ALLOCATOR_IMPLEMENTATION
+  // Calls fn (const Key&, Value&) on every entry, in unspecified order
+  template <class Function>
+  void for_each (Function fn);
 
+  private:
+  Generic_allocator *allocator;
+  Slot *slots = nullptr;
+  // Number of slots, a power of two (or 0), kept at least twice count
+  size_t capacity = 0;
+  size_t count = 0;
+  // Slots are indexed by the top bits of the hash, shifted down
+  unsigned int shift = 0;
 
-Allocator_cache* Allocator_cache :: construct (size_t sizeof_cache, Allocator_cache* old)
-  {
-  auto addr = (char*) malloc (sizeof_cache + sizeof_this);
-  
-  return (Allocator_cache*) new (addr) Allocator_cache (addr, sizeof_cache, old);
-  }
+  // Fibonacci hashing: Hash is mixed by a multiplication, so that hashes
+  // only differing in their high bits (such as std::hash of integers,
+  // the identity, for strided keys) spread over the slots
+  static constexpr size_t multiplier = sizeof(size_t) == 8 ? size_t (0x9e3779b97f4a7c15ULL) : size_t (0x9e3779b9UL);
 
-void Allocator_cache :: destruct (Allocator_cache* cache)
-  { free (cache); }
+  static size_t hash_of (const Key&);
+  // Slot for key: either holding key, or the empty slot where it belongs
+  Slot* probe (const Key& key, size_t hash) const;
+  void rehash (size_t sizeof_slots);
+  };
 
-Allocator_cache :: Allocator_cache (char *addr, size_t sizeof_cache, Allocator_cache *old) :
-  start (addr + sizeof_this),
-  end (start + sizeof_cache),
-  previous (old),
-  cursor (start)
-  {  }
+inline const char* Arena_string :: data() const
+  { return chars; }
 
+inline const char* Arena_string :: c_str() const
+  { return chars; }
 
-Allocator_base :: ~Allocator_base()
-  {  }
+inline size_t Arena_string :: size() const
+  { return length; }
 
+inline bool Arena_string :: empty() const
+  { return length == 0; }
 
-Generic_allocator :: Generic_allocator()
-  { cache = Allocator_cache::construct (cache_size); }
+inline std::string_view Arena_string :: view() const
+  { return std::string_view (chars, length); }
 
-Generic_allocator :: ~Generic_allocator()
-  { clear(); }
+inline Arena_string :: operator std::string_view() const
+  { return view(); }
 
-void Generic_allocator :: clear()
+inline bool Arena_string :: operator== (const Arena_string& other) const
+  { return (chars == other.chars && length == other.length) || view() == other.view(); }
+
+inline bool Arena_string :: operator!= (const Arena_string& other) const
+  { return !(*this == other); }
+
+inline size_t String_interner :: size() const
+  { return count; }
+
+
+// Intrusive containers: the links are stored in the objects themselves,
+// which derive from the container's hook (e.g. class Node : public
+// List_hook<Node>), so linking an object never allocates
+// Meant for objects of an Allocator, which are laid out in creation order:
+// containers filled in that order are traversed sequentially in memory
+// The containers don't own the objects, and destroy nothing
+
+// Hook of Intrusive_slist and Intrusive_list, walked by Link_iterator
+template <class Object>
+struct Slist_hook
   {
-  // Delete all Allocator_cache instances, save for the original one
-  while (true)
-    {
-    // Call the destructor for the allocated objects
-    for (auto pos = cache->start; pos != cache->cursor;)
-      {
-      auto obj_wrapper = (Obj_wrapper*)pos;
-      pos += sizeof_wrapper + obj_wrapper->sizeof_obj;
-      obj_wrapper->~Obj_wrapper();
-      }
+  Object *next = nullptr;
+  };
 
-    if (cache->previous == nullptr)
-      break;
-    else
-      {
-      auto tmp = cache->previous;
-      Allocator_cache::destruct (cache);
-      cache = tmp;
-      }
-    }
+template <class Object>
+struct List_hook
+  {
+  Object *next = nullptr;
+  Object *previous = nullptr;
+  };
+
+// Forward iterator following the next links of Hook
+template <class Object, class Hook>
+class Link_iterator
+  {
+  public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = Object;
+  using difference_type = ptrdiff_t;
+  using pointer = Object*;
+  using reference = Object&;
+
+  explicit Link_iterator (Object* node = nullptr);
+
+  reference operator* () const;
+  pointer operator-> () const;
+  Link_iterator& operator++ ();
+  Link_iterator operator++ (int);
+  bool operator== (const Link_iterator& other) const;
+  bool operator!= (const Link_iterator& other) const;
+
+  private:
+  Object *node;
+  };
+
+// Singly linked list, for stacks and append-only chains
+template <class Object>
+class Intrusive_slist
+  {
+  public:
+  using iterator = Link_iterator<Object, Slist_hook<Object>>;
+
+  Intrusive_slist() = default;
+  // Copies would link the same objects, and go out of sync once either
+  // is changed
+  Intrusive_slist (const Intrusive_slist&) = delete;
+  Intrusive_slist& operator= (const Intrusive_slist&) = delete;
+
+  void push_front (Object&);
+  // Unlinks the first object, returning it, or nullptr if the list is empty
+  Object* pop_front();
+  Object* front() const;
+  bool empty() const;
+
+  iterator begin() const;
+  iterator end() const;
+
+  private:
+  Object *head = nullptr;
+  };
+
+// Doubly linked list
+template <class Object>
+class Intrusive_list
+  {
+  public:
+  using iterator = Link_iterator<Object, List_hook<Object>>;
+
+  Intrusive_list() = default;
+  Intrusive_list (const Intrusive_list&) = delete;
+  Intrusive_list& operator= (const Intrusive_list&) = delete;
+
+  void push_front (Object&);
+  void push_back (Object&);
+  // Unlinks obj, which must be in the list
+  void erase (Object& obj);
+  Object* front() const;
+  Object* back() const;
+  bool empty() const;
+  size_t size() const;
+
+  iterator begin() const;
+  iterator end() const;
+
+  private:
+  Object *head = nullptr;
+  Object *tail = nullptr;
+  size_t count = 0;
+  };
+
+template <class Object>
+struct Tree_hook
+  {
+  Object *left = nullptr;
+  Object *right = nullptr;
+  // Height of the subtree rooted at the object, 1 for a leaf
+  int height = 1;
+  };
+
+// AVL tree, ordered by Compare
+// find() takes any key that Compare can compare with objects both ways,
+// such as the objects themselves
+template <class Object, class Compare = std::less<Object>>
+class Intrusive_tree
+  {
+  public:
+  class iterator;
+
+  Intrusive_tree() = default;
+  Intrusive_tree (const Intrusive_tree&) = delete;
+  Intrusive_tree& operator= (const Intrusive_tree&) = delete;
+
+  // Links obj into the tree, unless an equal object is already there
+  // Returns the object found in the tree: obj if it was inserted
+  Object* insert (Object& obj);
+  // Unlinks obj, which must be in the tree
+  void erase (Object& obj);
+  template <class Key>
+  Object* find (const Key& key) const;
+  bool empty() const;
+  size_t size() const;
+
+  // In order iteration: as the hooks have no parent link, each step
+  // searches from the root, in O(log n)
+  iterator begin() const;
+  iterator end() const;
+  // Calls fn (Object&) on every object, in order
+  // Faster than iterators, as each object is reached from its parent
+  template <class Function>
+  void for_each (Function fn) const;
+
+  private:
+  using Hook = Tree_hook<Object>;
+
+  Object *root = nullptr;
+  size_t count = 0;
+
+  static Hook& hook (Object*);
+  static int height (Object*);
+  static void update (Object*);
+  static Object* rotate_left (Object*);
+  static Object* rotate_right (Object*);
+  // Restores the balance of the subtree rooted at node, returning its root
+  static Object* rebalance (Object* node);
+  // Inserts obj in the subtree rooted at node, returning its new root;
+  // found is set to the object found in the tree
+  Object* insert (Object* node, Object& obj, Object*& found);
+  // Unlinks obj from the subtree rooted at node, returning its new root
+  Object* erase (Object* node, Object& obj);
+  // Unlinks the leftmost object of the subtree rooted at node into min,
+  // returning the new root of the subtree
+  static Object* erase_min (Object* node, Object*& min);
+  // Next object after node, in order, or nullptr
+  Object* successor (Object* node) const;
+  template <class Function>
+  static void for_each (Object* node, Function& fn);
+  };
+
+template <class Object, class Compare>
+class Intrusive_tree<Object, Compare>::iterator
+  {
+  public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = Object;
+  using difference_type = ptrdiff_t;
+  using pointer = Object*;
+  using reference = Object&;
+
+  iterator() = default;
+
+  reference operator* () const;
+  pointer operator-> () const;
+  iterator& operator++ ();
+  iterator operator++ (int);
+  bool operator== (const iterator& other) const;
+  bool operator!= (const iterator& other) const;
+
+  private:
+  friend class Intrusive_tree;
+
+  const Intrusive_tree *tree = nullptr;
+  Object *node = nullptr;
+
+  iterator (const Intrusive_tree*, Object*);
+  };
+
+
+// Structure-of-arrays allocator, for homogeneous records
+// Each row holds one value of each of the Fields, but every field is stored
+// in its own column of Rows_per_cache contiguous values, so that scanning
+// a single field reads memory sequentially
+// Each cache's cursor walks the first column, and its end marks the end
+// of the first column: the other columns follow it
+template <class Row_fields, size_t Rows_per_cache = 1024>
+class Soa_allocator;
+
+template <class ... Fields, size_t Rows_per_cache>
+class Soa_allocator<std::tuple<Fields...>, Rows_per_cache> : public Allocator_base
+  {
+  static_assert (sizeof...(Fields) > 0, "Soa_allocator error: no fields");
+
+  template <size_t I>
+  using Field = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+  static constexpr std::array<size_t, sizeof...(Fields)> field_sizes {sizeof(Fields)...};
+  static constexpr std::array<size_t, sizeof...(Fields)> field_alignments {alignof(Fields)...};
+  // Offset of the column of field i from the start of a cache
+  static constexpr size_t column_offset (size_t i);
+  static constexpr size_t sizeof_columns = column_offset (sizeof...(Fields));
+  
+  public:
+
+  // Handle to a row, resolving its fields without access to the allocator
+  class Row
+    {
+    public:
+    template <size_t I>
+    Field<I>& get() const;
+
+    private:
+    friend class Soa_allocator;
+    char *start;
+    size_t index;
+    };
+
+  Soa_allocator();
+  ~Soa_allocator();
+
+  // Creates a row from one argument per field, or default-constructs
+  // all fields if no argument is given
+  template <class ... Args>
+  Row create (Args&& ... args);
+  // See Allocator::clear()
+  void clear() override;
+
+  // Calls fn (Field<I>* first, Field<I>* last) on each cache's range of
+  // values of field I, in allocation order
+  template <size_t I, class Function>
+  void for_each_column (Function fn);
+
+  private:
+
+  static size_t rows_in (Allocator_cache*);
+  // Destroys the rows of the given cache, newest first
+  static void destroy_rows (Allocator_cache*);
+  template <size_t ... I, class ... Args>
+  static void construct_row (char* start, size_t index, std::index_sequence<I...>, Args&& ... args);
+  template <size_t ... I>
+  static void destroy_row (char* start, size_t index, std::index_sequence<I...>);
+  // Zeroes the used part of the columns after the first one
+  template <size_t ... I>
+  static void zero_columns (Allocator_cache*, std::index_sequence<I...>);
+  };
+
+
+
+template <class Object, class Policy>
+Allocator<Object, Policy> :: Allocator() :
+  Allocator_base (default_cache_size, default_cache_size)
+  {  }
+
+template <class Object, class Policy>
+Allocator<Object, Policy> :: Allocator (size_t first_cache_size, size_t cache_size) :
+  Allocator_base (first_cache_size, cache_size)
+  {  }
+
+template <class Object, class Policy>
+Allocator<Object, Policy> :: ~Allocator()
+  { clear(); }
+
+template <class Object, class Policy>
+template <class ... Args>
+Object* Allocator<Object, Policy> :: create (Args&& ... args)
+  {
+  std::lock_guard<typename Policy::lock> guard (lock);
+
+  if ((size_t)(limit - cursor) < sizeof_obj)
+    roll_over();
+  
+  // Placement new: allocates Object in place avoiding unnecessary memory movements
+  auto tmp = new (cursor) Object (std::forward<Args> (args)...);
+  cursor += sizeof_obj;
+  return tmp;
+  }
+
+template <class Object, class Policy>
+template <class ... Args>
+auto Allocator<Object, Policy> :: create_handle (Args&& ... args) -> Handle
+  {
+  std::lock_guard<typename Policy::lock> guard (lock);
+
+  if ((size_t)(limit - cursor) < sizeof_obj)
+    roll_over();
+  if (directory_cache != cache)
+    sync_directory();
+
+  new (cursor) Object (std::forward<Args> (args)...);
+  Handle handle {directory_base + uint32_t ((cursor - cache->start) / sizeof_obj)};
+  cursor += sizeof_obj;
+  return handle;
+  }
+
+template <class Object, class Policy>
+Object* Allocator<Object, Policy> :: get (Handle handle) const
+  { return (Object*)(directory[handle.index >> page_bits] + (handle.index & (page_size - 1)) * sizeof_obj); }
+
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: sync_directory()
+  {
+  auto current = directory_cache != nullptr ? directory_cache->next : first;
+  for (; current != nullptr; current = current->next)
+    {
+    directory_cache = current;
+    directory_base = uint32_t (directory.size() * page_size);
+    for (auto page = current->start; page < (char*)current->end; page += page_size * sizeof_obj)
+      {
+      // The indices must fit in a Handle
+      if (directory.size() >= (size_t (1) << 32) / page_size)
+        throw_or_abort (std::bad_alloc());
+      directory.push_back (page);
+      }
+    }
+  }
+
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: reset_directory()
+  {
+  directory.clear();
+  directory_cache = nullptr;
+  directory_base = 0;
+  }
+
+template <class Object, class Policy>
+bool Allocator<Object, Policy> :: is_dead (const Allocator_cache* cache, const char* pos)
+  {
+  if (cache->dead == nullptr)
+    return false;
+  size_t index = (pos - cache->start) / sizeof_obj;
+  return (cache->dead[index / 64] >> (index % 64)) & 1;
+  }
+
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: destroy (Object* obj)
+  {
+  std::lock_guard<typename Policy::lock> guard (lock);
+
+  auto pos = (char*)obj;
+  auto current = cache;
+  while (pos < current->start || pos >= (char*)current->end)
+    current = current->previous;
+
+  if (current->dead == nullptr)
+    {
+    size_t words = (current->capacity() / sizeof_obj + 63) / 64;
+    current->dead = (uint64_t*) calloc (words, sizeof(uint64_t));
+    if (current->dead == nullptr)
+      throw_or_abort (std::bad_alloc());
+    }
+  obj->~Object();
+  size_t index = (pos - current->start) / sizeof_obj;
+  current->dead[index / 64] |= uint64_t (1) << (index % 64);
+  }
+
+template <class Object, class Policy>
+template <class Function>
+void Allocator<Object, Policy> :: compact (Function fn)
+  {
+  std::lock_guard<typename Policy::lock> guard (lock);
+  save_cursor();
+  if (cache == Allocator_cache::empty())
+    return;
+
+  // Objects are only ever moved to an earlier position, so the write
+  // position never passes objects that haven't been read yet
+  auto write_cache = first;
+  auto write = first->start;
+  // Ends write_cache at write: with zero_caches, the memory left by the
+  // objects moved away is zeroed again
+  // write passes the cursor of caches that weren't full
+  auto end_write_cache = [&]
+    {
+    if (zero_caches && write < write_cache->cursor)
+      memset (write, 0, write_cache->cursor - write);
+    write_cache->cursor = write;
+    };
+  for (auto current = first; current != nullptr; current = current->next)
+    {
+    for (auto pos = current->start; pos != current->cursor; pos += sizeof_obj)
+      {
+      if (is_dead (current, pos))
+        continue;
+      if (write + sizeof_obj > (char*)write_cache->end)
+        {
+        end_write_cache();
+        write_cache = write_cache->next;
+        write = write_cache->start;
+        }
+      if (write != pos)
+        {
+        new (write) Object (std::move (*(Object*)pos));
+        ((Object*)pos)->~Object();
+        fn ((Object*)pos, (Object*)write);
+        }
+      write += sizeof_obj;
+      }
+    free (current->dead);
+    current->dead = nullptr;
+    }
+  end_write_cache();
+
+  // Free the caches after the last one written to
+  while (cache != write_cache)
+    {
+    auto tmp = cache->previous;
+    Allocator_cache::destruct (cache);
+    cache = tmp;
+    }
+  cache->next = nullptr;
+  load_cursor();
+  reset_directory();
+  }
+
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: snapshot (std::ostream& out) const
+  {
+  static_assert (std::is_trivially_copyable_v<Object>, "Allocator error: only trivially copyable objects can be saved");
+
+  Image_header header {image_magic, sizeof_obj, 0};
+  for (auto current = first; current != nullptr; current = current->next)
+    for (auto pos = current->start; pos != cursor_of (current); pos += sizeof_obj)
+      header.count += !is_dead (current, pos);
+  out.write ((const char*)&header, sizeof(header));
+
+  // Runs of consecutive live objects are written at once
+  for (auto current = first; current != nullptr; current = current->next)
+    {
+    auto run = current->start;
+    auto end = cursor_of (current);
+    for (auto pos = current->start; current->dead != nullptr && pos != end; pos += sizeof_obj)
+      if (is_dead (current, pos))
+        {
+        out.write (run, pos - run);
+        run = pos + sizeof_obj;
+        }
+    out.write (run, end - run);
+    }
+  }
+
+template <class Object, class Policy>
+bool Allocator<Object, Policy> :: restore (std::istream& in)
+  {
+  static_assert (std::is_trivially_copyable_v<Object>, "Allocator error: only trivially copyable objects can be restored");
+  clear();
+
+  Image_header header;
+  if (!in.read ((char*)&header, sizeof(header)) || header.magic != image_magic || header.sizeof_obj != sizeof_obj
+      || header.count > std::numeric_limits<size_t>::max() / sizeof_obj)
+    return false;
+
+  // The count is checked against the bytes left, when in can tell
+  size_t chunk = std::max (restore_chunk / sizeof_obj, size_t (1));
+  auto here = in.tellg();
+  if (here != std::istream::pos_type (-1) && in.seekg (0, std::ios::end))
+    {
+    auto left = (uint64_t)(in.tellg() - here);
+    in.seekg (here);
+    if (left < header.count * sizeof_obj)
+      return false;
+    chunk = header.count;
+    }
+  in.clear();
+
+  for (size_t left = header.count; left > 0;)
+    {
+    auto count = std::min (left, chunk);
+    reserve (count);
+    std::unique_lock<typename Policy::lock> guard (lock);
+    if (!in.read (cursor, count * sizeof_obj))
+      {
+      guard.unlock();
+      clear();
+      return false;
+      }
+    cursor += count * sizeof_obj;
+    left -= count;
+    }
+  return true;
+  }
+
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: roll_over()
+  {
+  save_cursor();
+  next_cache (Policy::growth::next (cache->capacity(), sizeof_cache()), sizeof_obj);
+  load_cursor();
+  }
+
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: clear()
+  {
+  std::lock_guard<typename Policy::lock> guard (lock);
+  save_cursor();
+
+  // Delete all Allocator_cache instances, save for the original one
+  while (true)
+    {
+    destroy_objects (cache);
+
+    if (cache->previous == nullptr)
+      break;
+    else
+      {
+      auto tmp = cache->previous;
+      Allocator_cache::destruct (cache);
+      cache = tmp;
+      }
+    }
+  // Reset the original instance
+  // The data is not modified (unless zero_caches is set), and Objects
+  // allocated in the first cache will remain accessible
+  reset_first();
+  load_cursor();
+  reset_directory();
+  }
+
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: clear_async()
+  {
+  std::lock_guard<typename Policy::lock> guard (lock);
+  save_cursor();
+
+  for (auto current = cache; current != nullptr; current = current->previous)
+    destroy_objects (current);
+  Allocator_reclaimer::release (detach_caches());
+  load_cursor();
+  reset_directory();
+  }
+
+// Objects are destroyed from the newest, so that clear() destroys them
+// in reverse allocation order
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: destroy_objects (Allocator_cache* cache)
+  {
+  for (auto pos = cache->cursor; pos != cache->start;)
+    {
+    pos -= sizeof_obj;
+    if (!is_dead (cache, pos))
+      ((Object*)pos)->~Object();
+    }
+  }
+
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: reserve (size_t count)
+  {
+  std::lock_guard<typename Policy::lock> guard (lock);
+  save_cursor();
+  reserve_cache (count * sizeof_obj);
+  load_cursor();
+  }
+
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: splice (Allocator&& other)
+  {
+  if (&other != this)
+    {
+    std::lock_guard<typename Policy::lock> guard (lock);
+    save_cursor();
+    other.save_cursor();
+    splice_chain (other);
+    load_cursor();
+    other.load_cursor();
+    other.reset_directory();
+    }
+  }
+
+template <class Object, class Policy>
+size_t Allocator<Object, Policy> :: sizeof_cache() const
+  {
+  if constexpr (Policy::cache_size != 0)
+    return Policy::cache_size;
+  else
+    return cache_size;
+  }
+
+
+template <class Object, class Policy>
+auto Allocator<Object, Policy> :: begin() -> iterator
+  { return make_iterator<Object>(); }
+
+template <class Object, class Policy>
+auto Allocator<Object, Policy> :: end() -> iterator
+  { return iterator(); }
+
+template <class Object, class Policy>
+auto Allocator<Object, Policy> :: begin() const -> const_iterator
+  { return make_iterator<const Object>(); }
+
+template <class Object, class Policy>
+auto Allocator<Object, Policy> :: end() const -> const_iterator
+  { return const_iterator(); }
+
+template <class Object, class Policy>
+template <class Value>
+auto Allocator<Object, Policy> :: make_iterator() const -> basic_iterator<Value>
+  {
+  return basic_iterator<Value> (first, cache, cursor);
+  }
+
+template <class Object, class Policy>
+template <class Function>
+void Allocator<Object, Policy> :: for_each (Function fn)
+  {
+  save_cursor();
+  for (auto current = first; current != nullptr; current = current->next)
+    for (auto pos = current->start; pos != current->cursor; pos += sizeof_obj)
+      if (!is_dead (current, pos))
+        fn (*(Object*)pos);
+  }
+
+template <class Object, class Policy>
+template <class Function>
+void Allocator<Object, Policy> :: for_each_range (Function fn)
+  {
+  static_assert (sizeof_obj == sizeof(Object), "Allocator error: objects are not contiguous");
+  save_cursor();
+  for (auto current = first; current != nullptr; current = current->next)
+    {
+    // Ranges are split around the objects destroyed by destroy()
+    auto range = current->start;
+    for (auto pos = current->start; current->dead != nullptr && pos != current->cursor; pos += sizeof_obj)
+      if (is_dead (current, pos))
+        {
+        if (range != pos)
+          fn ((Object*)range, (Object*)pos);
+        range = pos + sizeof_obj;
+        }
+    if (range != current->cursor)
+      fn ((Object*)range, (Object*)current->cursor);
+    }
+  }
+
+template <class Object, class Policy>
+template <class Function>
+void Allocator<Object, Policy> :: parallel_for_each (Function fn, unsigned int threads)
+  {
+  constexpr size_t sizeof_block = parallel_grain / sizeof_obj * sizeof_obj + sizeof_obj;
+
+  struct Block
+    {
+    Allocator_cache *cache;
+    char *first;
+    char *last;
+    };
+
+  // Only the blocks are listed, not the objects
+  save_cursor();
+  std::vector<Block> blocks;
+  for (auto current = first; current != nullptr; current = current->next)
+    for (auto pos = current->start; pos != current->cursor;)
+      {
+      auto block_end = current->cursor - pos > (ptrdiff_t)sizeof_block ? pos + sizeof_block : current->cursor;
+      blocks.push_back ({current, pos, block_end});
+      pos = block_end;
+      }
+
+  parallel_for (blocks.size(), threads, [&] (size_t i)
+    {
+    for (auto pos = blocks[i].first; pos != blocks[i].last; pos += sizeof_obj)
+      if (!is_dead (blocks[i].cache, pos))
+        fn (*(Object*)pos);
+    });
+  }
+
+template <class Object, class Policy>
+void Allocator<Object, Policy> :: parallel_clear (unsigned int threads)
+  {
+  if (threads <= 1)
+    return clear();
+
+  std::lock_guard<typename Policy::lock> guard (lock);
+
+  parallel_for_each ([] (Object& obj)
+    { obj.~Object(); }, threads);
+  release_caches (list_caches(), threads);
+  load_cursor();
+  reset_directory();
+  }
+
+
+template <class Object, class Policy>
+template <class Value>
+Allocator<Object, Policy>::basic_iterator<Value> :: basic_iterator (Allocator_cache* first, const Allocator_cache* current, char* current_cursor) :
+  cache (first),
+  pos (first->start),
+  current (current),
+  current_cursor (current_cursor)
+  {
+  if (pos == cache_cursor())
+    skip_empty();
+  skip_dead();
+  }
+
+template <class Object, class Policy>
+template <class Value>
+template <class Other>
+Allocator<Object, Policy>::basic_iterator<Value> :: basic_iterator (const basic_iterator<Other>& other) :
+  cache (other.cache),
+  pos (other.pos),
+  current (other.current),
+  current_cursor (other.current_cursor)
+  {  }
+
+template <class Object, class Policy>
+template <class Value>
+auto Allocator<Object, Policy>::basic_iterator<Value> :: operator* () const -> reference
+  { return *(Value*)pos; }
+
+template <class Object, class Policy>
+template <class Value>
+auto Allocator<Object, Policy>::basic_iterator<Value> :: operator-> () const -> pointer
+  { return (Value*)pos; }
+
+template <class Object, class Policy>
+template <class Value>
+auto Allocator<Object, Policy>::basic_iterator<Value> :: operator++ () -> basic_iterator&
+  {
+  pos += sizeof_obj;
+  if (pos == cache_cursor())
+    skip_empty();
+  skip_dead();
+  return *this;
+  }
+
+template <class Object, class Policy>
+template <class Value>
+auto Allocator<Object, Policy>::basic_iterator<Value> :: operator++ (int) -> basic_iterator
+  {
+  auto tmp = *this;
+  ++*this;
+  return tmp;
+  }
+
+template <class Object, class Policy>
+template <class Value>
+template <class Other>
+bool Allocator<Object, Policy>::basic_iterator<Value> :: operator== (const basic_iterator<Other>& other) const
+  { return pos == other.pos; }
+
+template <class Object, class Policy>
+template <class Value>
+template <class Other>
+bool Allocator<Object, Policy>::basic_iterator<Value> :: operator!= (const basic_iterator<Other>& other) const
+  { return pos != other.pos; }
+
+template <class Object, class Policy>
+template <class Value>
+void Allocator<Object, Policy>::basic_iterator<Value> :: skip_empty()
+  {
+  do
+    cache = cache->next;
+  while (cache != nullptr && cache->start == cache_cursor());
+
+  pos = cache != nullptr ? cache->start : nullptr;
+  }
+
+template <class Object, class Policy>
+template <class Value>
+void Allocator<Object, Policy>::basic_iterator<Value> :: skip_dead()
+  {
+  while (pos != nullptr && is_dead (cache, pos))
+    {
+    pos += sizeof_obj;
+    if (pos == cache_cursor())
+      skip_empty();
+    }
+  }
+
+template <class Object, class Policy>
+template <class Value>
+char* Allocator<Object, Policy>::basic_iterator<Value> :: cache_cursor() const
+  { return cache == current ? current_cursor : cache->cursor; }
+
+
+template <class Object, size_t Inline_size, class Policy>
+Inline_allocator<Object, Inline_size, Policy> :: Inline_allocator (bool zero_caches) :
+  Allocator<Object, Policy>()
+  {
+  this->zero_caches = zero_caches;
+  if (zero_caches)
+    memset (storage, 0, sizeof(storage));
+  this->cache = this->first = Allocator_cache::construct_in (storage, sizeof(storage));
+  this->load_cursor();
+  }
+
+template <class Object, size_t Inline_size, class Policy>
+Inline_allocator<Object, Inline_size, Policy> :: ~Inline_allocator()
+  {
+  this->clear();
+  // The remaining cache is our storage, which must not be freed
+  this->cache = this->first = Allocator_cache::empty();
+  this->load_cursor();
+  }
+
+
+template <class Object, class Policy>
+Region_allocator<Object, Policy> :: Region_allocator (Allocator_region& region) :
+  Allocator<Object, Policy> (region.size(), 0),
+  region (&region)
+  {
+  // With a cache size of 0, rolling over from the region's cache
+  // fails with std::bad_alloc, see Allocator_base::next_cache()
+  static_assert (Policy::cache_size == 0 && std::is_same_v<typename Policy::growth, Fixed_growth>, "Region_allocator error: caches can't grow");
+  // The objects found in the region must be Objects, so that the cursor
+  // lands on their end
+  auto used = region.used();
+  if (used != 0 && (region.stride() != this->sizeof_obj || used % this->sizeof_obj != 0))
+    throw_or_abort (std::system_error (EINVAL, std::generic_category(), "Region_allocator"));
+  if (!region.read_only())
+    region.set_stride (this->sizeof_obj);
+
+  this->cache = this->first = Allocator_cache::construct_over (cache_header, region.data(), region.data_size());
+  this->cache->cursor += used;
+  // A read-only region is full: create() throws std::bad_alloc instead
+  // of writing to it
+  if (region.read_only())
+    this->cache->end = this->cache->cursor;
+  this->load_cursor();
+  }
+
+template <class Object, class Policy>
+Region_allocator<Object, Policy> :: ~Region_allocator()
+  {
+  if (!region->persistent())
+    this->clear();
+  sync();
+  // Only frees the cache's dead bitmap, if any: the objects in the region
+  // were recorded by sync()
+  this->cache->reset();
+  // The remaining cache is in cache_header, which must not be freed
+  this->cache = this->first = Allocator_cache::empty();
+  this->load_cursor();
+  }
+
+template <class Object, class Policy>
+void Region_allocator<Object, Policy> :: clear()
+  {
+  if (!region->read_only())
+    Allocator<Object, Policy>::clear();
+  }
+
+template <class Object, class Policy>
+void Region_allocator<Object, Policy> :: sync()
+  {
+  if (region->read_only())
+    return;
+  region->set_used (this->cursor - this->cache->start);
+  region->flush();
+  }
+
+
+template <class Object>
+Arena_ptr<Object> :: Arena_ptr (const Allocator_region& region, Object* obj) :
+  value (obj != nullptr ? region.offset_of (obj) : 0)
+  {  }
+
+template <class Object>
+Object* Arena_ptr<Object> :: get (const Allocator_region& region) const
+  { return value != 0 ? (Object*)region.address_of (value) : nullptr; }
+
+template <class Object>
+uint32_t Arena_ptr<Object> :: offset() const
+  { return value; }
+
+template <class Object>
+Arena_ptr<Object> :: operator bool() const
+  { return value != 0; }
+
+template <class Object>
+bool Arena_ptr<Object> :: operator== (const Arena_ptr& other) const
+  { return value == other.value; }
+
+template <class Object>
+bool Arena_ptr<Object> :: operator!= (const Arena_ptr& other) const
+  { return value != other.value; }
+
+
+template <class Object, class ... Args>
+Object* Generic_allocator :: create (Args&& ... args)
+  {
+  if ((size_t)((char*)cache->end - cache->cursor) < sizeof_record<Object>)
+    next_cache (cache_size, sizeof_record<Object>);
+  
+  auto tmp = new (cache->cursor) Obj_wrapper ((Object*)nullptr, (uint32_t)(cache->cursor - cache->last), std::forward<Args> (args)...);
+  cache->last = cache->cursor;
+  cache->cursor += sizeof_record<Object>;
+  return (Object*)tmp->obj_ptr();
+  }
+
+template <class Object>
+void Generic_allocator :: reserve (size_t count)
+  { reserve (count * sizeof_record<Object>); }
+
+
+template <class Object>
+Arena_vector<Object> :: Arena_vector (Generic_allocator& allocator) :
+  allocator (&allocator)
+  {  }
+
+template <class Object>
+Arena_vector<Object> :: ~Arena_vector()
+  { clear(); }
+
+template <class Object>
+template <class ... Args>
+Object& Arena_vector<Object> :: emplace_back (Args&& ... args)
+  {
+  if (count == capacity_)
+    grow (count + 1);
+
+  auto tmp = new (elements + count) Object (std::forward<Args> (args)...);
+  count++;
+  return *tmp;
+  }
+
+template <class Object>
+void Arena_vector<Object> :: push_back (const Object& obj)
+  { emplace_back (obj); }
+
+template <class Object>
+void Arena_vector<Object> :: push_back (Object&& obj)
+  { emplace_back (std::move (obj)); }
+
+template <class Object>
+void Arena_vector<Object> :: pop_back()
+  { elements[--count].~Object(); }
+
+template <class Object>
+void Arena_vector<Object> :: clear()
+  {
+  if constexpr (std::is_trivially_destructible_v<Object>)
+    count = 0;
+  else
+    while (count > 0)
+      pop_back();
+  }
+
+template <class Object>
+void Arena_vector<Object> :: reserve (size_t min_capacity)
+  {
+  if (min_capacity > capacity_)
+    grow (min_capacity);
+  }
+
+template <class Object>
+void Arena_vector<Object> :: grow (size_t min_capacity)
+  {
+  auto new_capacity = capacity_ * 2 > min_capacity ? capacity_ * 2 : min_capacity;
+  if (new_capacity < 4)
+    new_capacity = 4;
+
+  if (elements != nullptr && allocator->extend (elements, (new_capacity - capacity_) * sizeof(Object)))
+    {
+    capacity_ = new_capacity;
+    return;
+    }
+
+  // The old storage is left to the allocator
+  auto tmp = (Object*) allocator->allocate (new_capacity * sizeof(Object));
+  for (size_t i = 0; i < count; i++)
+    {
+    new (tmp + i) Object (std::move_if_noexcept (elements[i]));
+    elements[i].~Object();
+    }
+  elements = tmp;
+  capacity_ = new_capacity;
+  }
+
+template <class Object>
+size_t Arena_vector<Object> :: size() const
+  { return count; }
+
+template <class Object>
+size_t Arena_vector<Object> :: capacity() const
+  { return capacity_; }
+
+template <class Object>
+bool Arena_vector<Object> :: empty() const
+  { return count == 0; }
+
+template <class Object>
+Object* Arena_vector<Object> :: data()
+  { return elements; }
+
+template <class Object>
+const Object* Arena_vector<Object> :: data() const
+  { return elements; }
+
+template <class Object>
+Object& Arena_vector<Object> :: operator[] (size_t i)
+  { return elements[i]; }
+
+template <class Object>
+const Object& Arena_vector<Object> :: operator[] (size_t i) const
+  { return elements[i]; }
+
+template <class Object>
+Object& Arena_vector<Object> :: back()
+  { return elements[count - 1]; }
+
+template <class Object>
+const Object& Arena_vector<Object> :: back() const
+  { return elements[count - 1]; }
+
+template <class Object>
+auto Arena_vector<Object> :: begin() -> iterator
+  { return elements; }
+
+template <class Object>
+auto Arena_vector<Object> :: end() -> iterator
+  { return elements + count; }
+
+template <class Object>
+auto Arena_vector<Object> :: begin() const -> const_iterator
+  { return elements; }
+
+template <class Object>
+auto Arena_vector<Object> :: end() const -> const_iterator
+  { return elements + count; }
+
+
+template <class Key, class Value, class Hash, class Equal>
+Arena_hash_map<Key, Value, Hash, Equal> :: Arena_hash_map (Generic_allocator& allocator) :
+  allocator (&allocator)
+  {  }
+
+template <class Key, class Value, class Hash, class Equal>
+Arena_hash_map<Key, Value, Hash, Equal> :: ~Arena_hash_map()
+  {
+  if constexpr (!std::is_trivially_destructible_v<Key> || !std::is_trivially_destructible_v<Value>)
+    for (size_t i = 0; i < capacity; i++)
+      if (slots[i].hash != 0)
+        {
+        slots[i].key.~Key();
+        slots[i].value.~Value();
+        }
+  }
+
+template <class Key, class Value, class Hash, class Equal>
+template <class ... Args>
+auto Arena_hash_map<Key, Value, Hash, Equal> :: emplace (const Key& key, Args&& ... args) -> std::pair<Value*, bool>
+  {
+  auto hash = hash_of (key);
+  auto slot = capacity != 0 ? probe (key, hash) : nullptr;
+  if (slot != nullptr && slot->hash != 0)
+    return {&slot->value, false};
+
+  // Only growing when inserting, so that finding a key moves nothing
+  if ((count + 1) * 2 > capacity)
+    {
+    rehash (capacity == 0 ? 16 : capacity * 2);
+    slot = probe (key, hash);
+    }
+
+  new (&slot->key) Key (key);
+  new (&slot->value) Value (std::forward<Args> (args)...);
+  slot->hash = hash;
+  count++;
+  return {&slot->value, true};
+  }
+
+template <class Key, class Value, class Hash, class Equal>
+Value& Arena_hash_map<Key, Value, Hash, Equal> :: operator[] (const Key& key)
+  { return *emplace (key).first; }
+
+template <class Key, class Value, class Hash, class Equal>
+Value* Arena_hash_map<Key, Value, Hash, Equal> :: find (const Key& key)
+  { return const_cast<Value*> (static_cast<const Arena_hash_map*> (this)->find (key)); }
+
+template <class Key, class Value, class Hash, class Equal>
+const Value* Arena_hash_map<Key, Value, Hash, Equal> :: find (const Key& key) const
+  {
+  if (count == 0)
+    return nullptr;
+
+  auto slot = probe (key, hash_of (key));
+  return slot->hash != 0 ? &slot->value : nullptr;
+  }
+
+template <class Key, class Value, class Hash, class Equal>
+size_t Arena_hash_map<Key, Value, Hash, Equal> :: size() const
+  { return count; }
+
+template <class Key, class Value, class Hash, class Equal>
+bool Arena_hash_map<Key, Value, Hash, Equal> :: empty() const
+  { return count == 0; }
+
+template <class Key, class Value, class Hash, class Equal>
+void Arena_hash_map<Key, Value, Hash, Equal> :: reserve (size_t entries)
+  {
+  auto sizeof_slots = capacity == 0 ? 16 : capacity;
+  while (entries * 2 > sizeof_slots)
+    sizeof_slots *= 2;
+  if (sizeof_slots > capacity)
+    rehash (sizeof_slots);
+  }
+
+template <class Key, class Value, class Hash, class Equal>
+template <class Function>
+void Arena_hash_map<Key, Value, Hash, Equal> :: for_each (Function fn)
+  {
+  for (size_t i = 0; i < capacity; i++)
+    if (slots[i].hash != 0)
+      fn (const_cast<const Key&> (slots[i].key), slots[i].value);
+  }
+
+// 0 marks empty slots, so it's never used as a hash
+template <class Key, class Value, class Hash, class Equal>
+size_t Arena_hash_map<Key, Value, Hash, Equal> :: hash_of (const Key& key)
+  {
+  auto hash = Hash() (key) * multiplier;
+  return hash != 0 ? hash : 1;
+  }
+
+template <class Key, class Value, class Hash, class Equal>
+auto Arena_hash_map<Key, Value, Hash, Equal> :: probe (const Key& key, size_t hash) const -> Slot*
+  {
+  auto mask = capacity - 1;
+  for (auto i = hash >> shift;; i = (i + 1) & mask)
+    if (slots[i].hash == 0 || (slots[i].hash == hash && Equal() (slots[i].key, key)))
+      return slots + i;
+  }
+
+template <class Key, class Value, class Hash, class Equal>
+void Arena_hash_map<Key, Value, Hash, Equal> :: rehash (size_t sizeof_slots)
+  {
+  // The old table is left to the allocator
+  auto old = slots;
+  auto old_capacity = capacity;
+  slots = (Slot*) allocator->allocate (sizeof_slots * sizeof(Slot));
+  capacity = sizeof_slots;
+  shift = std::numeric_limits<size_t>::digits;
+  for (auto i = capacity; i > 1; i /= 2)
+    shift--;
+  for (size_t i = 0; i < capacity; i++)
+    slots[i].hash = 0;
+
+  for (size_t i = 0; i < old_capacity; i++)
+    if (old[i].hash != 0)
+      {
+      auto slot = slots + (old[i].hash >> shift);
+      while (slot->hash != 0)
+        slot = slot + 1 != slots + capacity ? slot + 1 : slots;
+      new (&slot->key) Key (std::move_if_noexcept (old[i].key));
+      new (&slot->value) Value (std::move_if_noexcept (old[i].value));
+      slot->hash = old[i].hash;
+      old[i].key.~Key();
+      old[i].value.~Value();
+      }
+  }
+
+
+template <class Object, class Hook>
+Link_iterator<Object, Hook> :: Link_iterator (Object* node) :
+  node (node)
+  {  }
+
+template <class Object, class Hook>
+auto Link_iterator<Object, Hook> :: operator* () const -> reference
+  { return *node; }
+
+template <class Object, class Hook>
+auto Link_iterator<Object, Hook> :: operator-> () const -> pointer
+  { return node; }
+
+template <class Object, class Hook>
+auto Link_iterator<Object, Hook> :: operator++ () -> Link_iterator&
+  {
+  node = static_cast<Hook*> (node)->next;
+  return *this;
+  }
+
+template <class Object, class Hook>
+auto Link_iterator<Object, Hook> :: operator++ (int) -> Link_iterator
+  {
+  auto tmp = *this;
+  ++*this;
+  return tmp;
+  }
+
+template <class Object, class Hook>
+bool Link_iterator<Object, Hook> :: operator== (const Link_iterator& other) const
+  { return node == other.node; }
+
+template <class Object, class Hook>
+bool Link_iterator<Object, Hook> :: operator!= (const Link_iterator& other) const
+  { return node != other.node; }
+
+
+template <class Object>
+void Intrusive_slist<Object> :: push_front (Object& obj)
+  {
+  static_cast<Slist_hook<Object>&> (obj).next = head;
+  head = &obj;
+  }
+
+template <class Object>
+Object* Intrusive_slist<Object> :: pop_front()
+  {
+  auto tmp = head;
+  if (tmp == nullptr)
+    return nullptr;
+  head = static_cast<Slist_hook<Object>*> (tmp)->next;
+  static_cast<Slist_hook<Object>*> (tmp)->next = nullptr;
+  return tmp;
+  }
+
+template <class Object>
+Object* Intrusive_slist<Object> :: front() const
+  { return head; }
+
+template <class Object>
+bool Intrusive_slist<Object> :: empty() const
+  { return head == nullptr; }
+
+template <class Object>
+auto Intrusive_slist<Object> :: begin() const -> iterator
+  { return iterator (head); }
+
+template <class Object>
+auto Intrusive_slist<Object> :: end() const -> iterator
+  { return iterator(); }
+
+
+template <class Object>
+void Intrusive_list<Object> :: push_front (Object& obj)
+  {
+  auto& hook = static_cast<List_hook<Object>&> (obj);
+  hook.previous = nullptr;
+  hook.next = head;
+  if (head != nullptr)
+    static_cast<List_hook<Object>*> (head)->previous = &obj;
+  else
+    tail = &obj;
+  head = &obj;
+  count++;
+  }
+
+template <class Object>
+void Intrusive_list<Object> :: push_back (Object& obj)
+  {
+  auto& hook = static_cast<List_hook<Object>&> (obj);
+  hook.next = nullptr;
+  hook.previous = tail;
+  if (tail != nullptr)
+    static_cast<List_hook<Object>*> (tail)->next = &obj;
+  else
+    head = &obj;
+  tail = &obj;
+  count++;
+  }
+
+template <class Object>
+void Intrusive_list<Object> :: erase (Object& obj)
+  {
+  auto& hook = static_cast<List_hook<Object>&> (obj);
+  if (hook.previous != nullptr)
+    static_cast<List_hook<Object>*> (hook.previous)->next = hook.next;
+  else
+    head = hook.next;
+  if (hook.next != nullptr)
+    static_cast<List_hook<Object>*> (hook.next)->previous = hook.previous;
+  else
+    tail = hook.previous;
+  hook.next = hook.previous = nullptr;
+  count--;
+  }
+
+template <class Object>
+Object* Intrusive_list<Object> :: front() const
+  { return head; }
+
+template <class Object>
+Object* Intrusive_list<Object> :: back() const
+  { return tail; }
+
+template <class Object>
+bool Intrusive_list<Object> :: empty() const
+  { return head == nullptr; }
+
+template <class Object>
+size_t Intrusive_list<Object> :: size() const
+  { return count; }
+
+template <class Object>
+auto Intrusive_list<Object> :: begin() const -> iterator
+  { return iterator (head); }
+
+template <class Object>
+auto Intrusive_list<Object> :: end() const -> iterator
+  { return iterator(); }
+
+
+template <class Object, class Compare>
+Object* Intrusive_tree<Object, Compare> :: insert (Object& obj)
+  {
+  Object* found = nullptr;
+  root = insert (root, obj, found);
+  return found;
+  }
+
+template <class Object, class Compare>
+void Intrusive_tree<Object, Compare> :: erase (Object& obj)
+  { root = erase (root, obj); }
+
+template <class Object, class Compare>
+template <class Key>
+Object* Intrusive_tree<Object, Compare> :: find (const Key& key) const
+  {
+  Compare compare;
+  auto node = root;
+  while (node != nullptr)
+    {
+    if (compare (key, *node))
+      node = hook (node).left;
+    else if (compare (*node, key))
+      node = hook (node).right;
+    else
+      return node;
+    }
+  return nullptr;
+  }
+
+template <class Object, class Compare>
+bool Intrusive_tree<Object, Compare> :: empty() const
+  { return root == nullptr; }
+
+template <class Object, class Compare>
+size_t Intrusive_tree<Object, Compare> :: size() const
+  { return count; }
+
+template <class Object, class Compare>
+auto Intrusive_tree<Object, Compare> :: begin() const -> iterator
+  {
+  auto node = root;
+  while (node != nullptr && hook (node).left != nullptr)
+    node = hook (node).left;
+  return iterator (this, node);
+  }
+
+template <class Object, class Compare>
+auto Intrusive_tree<Object, Compare> :: end() const -> iterator
+  { return iterator (this, nullptr); }
+
+template <class Object, class Compare>
+template <class Function>
+void Intrusive_tree<Object, Compare> :: for_each (Function fn) const
+  { for_each (root, fn); }
+
+template <class Object, class Compare>
+template <class Function>
+void Intrusive_tree<Object, Compare> :: for_each (Object* node, Function& fn)
+  {
+  // The depth is logarithmic, so recursing is safe
+  if (node == nullptr)
+    return;
+  for_each (hook (node).left, fn);
+  fn (*node);
+  for_each (hook (node).right, fn);
+  }
+
+template <class Object, class Compare>
+auto Intrusive_tree<Object, Compare> :: hook (Object* node) -> Hook&
+  { return *static_cast<Hook*> (node); }
+
+template <class Object, class Compare>
+int Intrusive_tree<Object, Compare> :: height (Object* node)
+  { return node != nullptr ? hook (node).height : 0; }
+
+template <class Object, class Compare>
+void Intrusive_tree<Object, Compare> :: update (Object* node)
+  { hook (node).height = std::max (height (hook (node).left), height (hook (node).right)) + 1; }
+
+template <class Object, class Compare>
+Object* Intrusive_tree<Object, Compare> :: rotate_left (Object* node)
+  {
+  auto right = hook (node).right;
+  hook (node).right = hook (right).left;
+  hook (right).left = node;
+  update (node);
+  update (right);
+  return right;
+  }
+
+template <class Object, class Compare>
+Object* Intrusive_tree<Object, Compare> :: rotate_right (Object* node)
+  {
+  auto left = hook (node).left;
+  hook (node).left = hook (left).right;
+  hook (left).right = node;
+  update (node);
+  update (left);
+  return left;
+  }
+
+template <class Object, class Compare>
+Object* Intrusive_tree<Object, Compare> :: rebalance (Object* node)
+  {
+  update (node);
+  auto balance = height (hook (node).left) - height (hook (node).right);
+  if (balance > 1)
+    {
+    if (height (hook (hook (node).left).left) < height (hook (hook (node).left).right))
+      hook (node).left = rotate_left (hook (node).left);
+    return rotate_right (node);
+    }
+  if (balance < -1)
+    {
+    if (height (hook (hook (node).right).right) < height (hook (hook (node).right).left))
+      hook (node).right = rotate_right (hook (node).right);
+    return rotate_left (node);
+    }
+  return node;
+  }
+
+template <class Object, class Compare>
+Object* Intrusive_tree<Object, Compare> :: insert (Object* node, Object& obj, Object*& found)
+  {
+  if (node == nullptr)
+    {
+    auto& obj_hook = hook (&obj);
+    obj_hook.left = obj_hook.right = nullptr;
+    obj_hook.height = 1;
+    found = &obj;
+    count++;
+    return &obj;
+    }
+
+  Compare compare;
+  if (compare (obj, *node))
+    hook (node).left = insert (hook (node).left, obj, found);
+  else if (compare (*node, obj))
+    hook (node).right = insert (hook (node).right, obj, found);
+  else
+    {
+    found = node;
+    return node;
+    }
+  return rebalance (node);
+  }
+
+template <class Object, class Compare>
+Object* Intrusive_tree<Object, Compare> :: erase (Object* node, Object& obj)
+  {
+  Compare compare;
+  if (compare (obj, *node))
+    hook (node).left = erase (hook (node).left, obj);
+  else if (compare (*node, obj))
+    hook (node).right = erase (hook (node).right, obj);
+  else
+    {
+    // node is obj: its successor, if it has two children, takes its place
+    auto left = hook (node).left;
+    auto right = hook (node).right;
+    hook (node).left = hook (node).right = nullptr;
+    hook (node).height = 1;
+    count--;
+    if (left == nullptr)
+      return right;
+    if (right == nullptr)
+      return left;
+    Object* min;
+    right = erase_min (right, min);
+    hook (min).left = left;
+    hook (min).right = right;
+    return rebalance (min);
+    }
+  return rebalance (node);
+  }
+
+template <class Object, class Compare>
+Object* Intrusive_tree<Object, Compare> :: erase_min (Object* node, Object*& min)
+  {
+  if (hook (node).left == nullptr)
+    {
+    min = node;
+    return hook (node).right;
+    }
+  hook (node).left = erase_min (hook (node).left, min);
+  return rebalance (node);
+  }
+
+template <class Object, class Compare>
+Object* Intrusive_tree<Object, Compare> :: successor (Object* node) const
+  {
+  // The smallest object greater than node
+  Compare compare;
+  Object* next = nullptr;
+  for (auto current = root; current != nullptr;)
+    if (compare (*node, *current))
+      {
+      next = current;
+      current = hook (current).left;
+      }
+    else
+      current = hook (current).right;
+  return next;
+  }
+
+
+template <class Object, class Compare>
+Intrusive_tree<Object, Compare>::iterator :: iterator (const Intrusive_tree* tree, Object* node) :
+  tree (tree),
+  node (node)
+  {  }
+
+template <class Object, class Compare>
+auto Intrusive_tree<Object, Compare>::iterator :: operator* () const -> reference
+  { return *node; }
+
+template <class Object, class Compare>
+auto Intrusive_tree<Object, Compare>::iterator :: operator-> () const -> pointer
+  { return node; }
+
+template <class Object, class Compare>
+auto Intrusive_tree<Object, Compare>::iterator :: operator++ () -> iterator&
+  {
+  node = tree->successor (node);
+  return *this;
+  }
+
+template <class Object, class Compare>
+auto Intrusive_tree<Object, Compare>::iterator :: operator++ (int) -> iterator
+  {
+  auto tmp = *this;
+  ++*this;
+  return tmp;
+  }
+
+template <class Object, class Compare>
+bool Intrusive_tree<Object, Compare>::iterator :: operator== (const iterator& other) const
+  { return node == other.node; }
+
+template <class Object, class Compare>
+bool Intrusive_tree<Object, Compare>::iterator :: operator!= (const iterator& other) const
+  { return node != other.node; }
+
+
+template <class Obj, class ... Args>
+Obj_wrapper :: Obj_wrapper (Obj*, uint32_t sizeof_previous, Args&& ... args) :
+  sizeof_obj (sizeof(Obj) + alignof (Obj)),
+  sizeof_previous (sizeof_previous),
+  destructor_ptr (destructor_wrapper<Obj>)
+  {
+  // Check that the object's size is not bigger than what our size variable allows for
+  static_assert (sizeof(Obj) + alignof (Obj) <= std::numeric_limits<uint8_t>::max(), "Generic_allocator error: object exceeds maxiumum size");
+  new (obj_ptr()) Obj (std::forward<Args>(args)...);
+  }
+
+
+template <class ... Fields, size_t Rows_per_cache>
+constexpr size_t Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: column_offset (size_t i)
+  {
+  size_t offset = 0;
+  for (size_t field = 0; field < i; field++)
+    {
+    offset = (offset + field_alignments[field] - 1) / field_alignments[field] * field_alignments[field];
+    offset += field_sizes[field] * Rows_per_cache;
+    }
+  if (i < sizeof...(Fields))
+    offset = (offset + field_alignments[i] - 1) / field_alignments[i] * field_alignments[i];
+  return offset;
+  }
+
+template <class ... Fields, size_t Rows_per_cache>
+template <size_t I>
+auto Soa_allocator<std::tuple<Fields...>, Rows_per_cache>::Row :: get() const -> Field<I>&
+  { return ((Field<I>*)(start + column_offset (I)))[index]; }
+
+template <class ... Fields, size_t Rows_per_cache>
+Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: Soa_allocator() :
+  Allocator_base (sizeof_columns, sizeof_columns)
+  {
+  static_assert (std::max ({alignof(Fields)...}) <= Allocator_cache::line_size, "Soa_allocator error: alignment exceeds the alignment of caches");
+  }
+
+template <class ... Fields, size_t Rows_per_cache>
+Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: ~Soa_allocator()
+  { clear(); }
+
+template <class ... Fields, size_t Rows_per_cache>
+template <class ... Args>
+auto Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: create (Args&& ... args) -> Row
+  {
+  static_assert (sizeof...(Args) == 0 || sizeof...(Args) == sizeof...(Fields), "Soa_allocator error: one argument per field is needed");
+  
+  if ((size_t)((char*)cache->end - cache->cursor) < field_sizes[0])
+    {
+    next_cache (cache_size, sizeof_columns);
+    cache->end = cache->start + field_sizes[0] * Rows_per_cache;
+    }
+
+  Row row;
+  row.start = cache->start;
+  row.index = rows_in (cache);
+  construct_row (row.start, row.index, std::index_sequence_for<Fields...>(), std::forward<Args> (args)...);
+  cache->cursor += field_sizes[0];
+  return row;
+  }
+
+template <class ... Fields, size_t Rows_per_cache>
+template <size_t ... I, class ... Args>
+void Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: construct_row (char* start, size_t index, std::index_sequence<I...>, Args&& ... args)
+  {
+  if constexpr (sizeof...(Args) == 0)
+    (new ((Field<I>*)(start + column_offset (I)) + index) Field<I>(), ...);
+  else
+    (new ((Field<I>*)(start + column_offset (I)) + index) Field<I> (std::forward<Args> (args)), ...);
+  }
+
+template <class ... Fields, size_t Rows_per_cache>
+void Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: clear()
+  {
+  // Delete all Allocator_cache instances, save for the original one
+  while (true)
+    {
+    destroy_rows (cache);
+
+    if (cache->previous == nullptr)
+      break;
+    else
+      {
+      auto tmp = cache->previous;
+      Allocator_cache::destruct (cache);
+      cache = tmp;
+      }
+    }
+  // Only the first column is zeroed by reset_first()
+  if (zero_caches)
+    zero_columns (cache, std::make_index_sequence<sizeof...(Fields) - 1>());
+  reset_first();
+  }
+
+template <class ... Fields, size_t Rows_per_cache>
+template <size_t I, class Function>
+void Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: for_each_column (Function fn)
+  {
+  for (auto current = first; current != nullptr; current = current->next)
+    if (current->cursor != current->start)
+      {
+      auto column = (Field<I>*)(current->start + column_offset (I));
+      fn (column, column + rows_in (current));
+      }
+  }
+
+template <class ... Fields, size_t Rows_per_cache>
+size_t Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: rows_in (Allocator_cache* cache)
+  { return (cache->cursor - cache->start) / field_sizes[0]; }
+
+template <class ... Fields, size_t Rows_per_cache>
+void Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: destroy_rows (Allocator_cache* cache)
+  {
+  for (auto row = rows_in (cache); row-- > 0;)
+    destroy_row (cache->start, row, std::index_sequence_for<Fields...>());
+  }
+
+template <class ... Fields, size_t Rows_per_cache>
+template <size_t ... I>
+void Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: zero_columns (Allocator_cache* cache, std::index_sequence<I...>)
+  {
+  auto rows = rows_in (cache);
+  (memset (cache->start + column_offset (I + 1), 0, rows * field_sizes[I + 1]), ...);
+  }
+
+template <class ... Fields, size_t Rows_per_cache>
+template <size_t ... I>
+void Soa_allocator<std::tuple<Fields...>, Rows_per_cache> :: destroy_row (char* start, size_t index, std::index_sequence<I...>)
+  { (std::destroy_at ((Field<I>*)(start + column_offset (I)) + index), ...); }
+
+
+// All non template functiond definitions are in this ifdef'd area.
+#ifdef ALLOCATOR_IMPLEMENTATION
+
+#ifdef ALLOCATOR_HAS_MMAN
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+
+Allocator_cache* Allocator_cache :: construct (size_t sizeof_cache, Allocator_cache* old, bool zeroed)
+  {
+  if (sizeof_cache > std::numeric_limits<size_t>::max() - sizeof_this)
+    throw_or_abort (std::bad_alloc());
+  auto addr = (char*) (zeroed ? calloc (1, sizeof_cache + sizeof_this) : malloc (sizeof_cache + sizeof_this));
+  if (addr == nullptr)
+    throw_or_abort (std::bad_alloc());
+  
+  return (Allocator_cache*) new (addr) Allocator_cache (addr, sizeof_cache, old);
+  }
+
+Allocator_cache* Allocator_cache :: construct_in (void* addr, size_t sizeof_memory)
+  {
+  auto capacity = (char*)addr + sizeof_memory - data_start ((char*)addr);
+  return (Allocator_cache*) new (addr) Allocator_cache ((char*)addr, capacity, nullptr);
+  }
+
+Allocator_cache* Allocator_cache :: construct_over (void* header, void* memory, size_t sizeof_memory)
+  {
+  return (Allocator_cache*) new (header) Allocator_cache ((char*)memory, sizeof_memory);
+  }
+
+void Allocator_cache :: destruct (Allocator_cache* cache)
+  {
+  free (cache->dead);
+  free (cache);
+  }
+
+char* Allocator_cache :: data_start (char* addr)
+  {
+  auto header_end = (uintptr_t)addr + sizeof(Allocator_cache);
+  return addr + ((header_end + line_size - 1) / line_size * line_size - (uintptr_t)addr);
+  }
+
+Allocator_cache :: Allocator_cache (char *addr, size_t sizeof_cache, Allocator_cache *old) :
+  start (data_start (addr)),
+  end (start + sizeof_cache),
+  previous (old),
+  next (nullptr),
+  cursor (start),
+  last (start),
+  dead (nullptr)
+  {
+  if (old != nullptr)
+    old->next = this;
+  }
+
+Allocator_cache :: Allocator_cache (char* start, size_t sizeof_cache) :
+  start (start),
+  end (start + sizeof_cache),
+  previous (nullptr),
+  next (nullptr),
+  cursor (start),
+  last (start),
+  dead (nullptr)
+  {  }
+
+Allocator_cache Allocator_cache :: empty_cache;
+
+
+// Derived destructors clear() the allocator, leaving only the first cache
+Allocator_base :: ~Allocator_base()
+  {
+  if (cache != Allocator_cache::empty())
+    Allocator_cache::destruct (cache);
+  }
+
+Allocator_base :: Allocator_base (size_t first_cache_size, size_t cache_size) :
+  first_cache_size (first_cache_size),
+  cache_size (cache_size)
+  {  }
+
+void Allocator_base :: next_cache (size_t sizeof_cache, size_t sizeof_needed)
+  {
+  if (cache == Allocator_cache::empty())
+    sizeof_cache = first_cache_size;
+  if (sizeof_needed > sizeof_cache)
+    throw_or_abort (std::bad_alloc());
+
+  push_cache (sizeof_cache);
+  }
+
+void Allocator_base :: reserve_cache (size_t sizeof_needed)
+  {
+  if ((char*)cache->end - cache->cursor >= (ptrdiff_t)sizeof_needed)
+    return;
+
+  // The rest of the current cache is left unused
+  size_t sizeof_cache = cache == Allocator_cache::empty() ? first_cache_size : cache_size;
+  push_cache (sizeof_needed > sizeof_cache ? sizeof_needed : sizeof_cache);
+  }
+
+void Allocator_base :: push_cache (size_t sizeof_cache)
+  {
+  if (cache == Allocator_cache::empty())
+    cache = first = Allocator_cache::construct (sizeof_cache, nullptr, zero_caches);
+  else
+    cache = Allocator_cache::construct (sizeof_cache, cache, zero_caches);
+  }
+
+void Allocator_base :: splice_chain (Allocator_base& other)
+  {
+  if (other.cache == Allocator_cache::empty())
+    return;
+
+  // The oldest of other's caches now follows our current one, and
+  // other's current cache becomes ours: allocation continues there
+  if (cache == Allocator_cache::empty())
+    first = other.first;
+  else
+    {
+    other.first->previous = cache;
+    cache->next = other.first;
+    }
+  cache = other.cache;
+  other.cache = other.first = Allocator_cache::empty();
+  }
+
+std::vector<Allocator_cache*> Allocator_base :: list_caches() const
+  {
+  std::vector<Allocator_cache*> caches;
+  for (auto current = first; current != nullptr; current = current->next)
+    caches.push_back (current);
+  return caches;
+  }
+
+void Allocator_base :: release_caches (const std::vector<Allocator_cache*>& caches, unsigned int threads)
+  {
+  parallel_for (caches.size() - 1, threads, [&] (size_t i)
+    { Allocator_cache::destruct (caches[i + 1]); });
+
+  reset_first();
+  }
+
+void Allocator_base :: reset_first()
+  {
+  cache = first;
+  if (cache == Allocator_cache::empty())
+    return;
+
+  if (zero_caches)
+    memset (cache->start, 0, cache->cursor - cache->start);
+  cache->reset();
+  }
+
+Allocator_cache* Allocator_base :: detach_caches()
+  {
+  auto detached = first->next;
+  if (detached != nullptr)
+    detached->previous = nullptr;
+
+  reset_first();
+  return detached;
+  }
+
+
+void Allocator_reclaimer :: release (Allocator_cache* caches)
+  {
+  if (caches == nullptr)
+    return;
+
+  auto& reclaimer = instance();
+    {
+    std::lock_guard<std::mutex> guard (reclaimer.mutex);
+    reclaimer.pending.push_back (caches);
+    }
+  reclaimer.wake.notify_one();
+  }
+
+void Allocator_reclaimer :: drain()
+  {
+  auto& reclaimer = instance();
+  std::unique_lock<std::mutex> guard (reclaimer.mutex);
+  reclaimer.idle.wait (guard, [&]
+    { return reclaimer.pending.empty() && !reclaimer.busy; });
+  }
+
+Allocator_reclaimer :: Allocator_reclaimer() :
+  thread ([this]
+    { run(); })
+  {  }
+
+// Frees whatever is still pending before exiting
+Allocator_reclaimer :: ~Allocator_reclaimer()
+  {
+    {
+    std::lock_guard<std::mutex> guard (mutex);
+    stop = true;
+    }
+  wake.notify_one();
+  thread.join();
+  }
+
+Allocator_reclaimer& Allocator_reclaimer :: instance()
+  {
+  static Allocator_reclaimer reclaimer;
+  return reclaimer;
+  }
+
+void Allocator_reclaimer :: run()
+  {
+  std::unique_lock<std::mutex> guard (mutex);
+  while (true)
+    {
+    wake.wait (guard, [this]
+      { return stop || !pending.empty(); });
+    if (pending.empty())
+      break;
+
+    // Free the caches without holding the lock, so that release() never waits
+    auto caches = std::move (pending);
+    pending.clear();
+    busy = true;
+    guard.unlock();
+    for (auto current : caches)
+      while (current != nullptr)
+        {
+        auto tmp = current->next;
+        Allocator_cache::destruct (current);
+        current = tmp;
+        }
+    guard.lock();
+    busy = false;
+    idle.notify_all();
+    }
+  }
+
+
+Allocator_region :: Allocator_region (size_t size) :
+  sizeof_region (size)
+  {
+  if (size < sizeof_header || size > (size_t)std::numeric_limits<uint32_t>::max() + 1)
+    throw_or_abort (std::bad_alloc());
+
+#ifdef ALLOCATOR_HAS_MMAN
+  auto addr = mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  memory = addr != MAP_FAILED ? (char*)addr : nullptr;
+#else
+  memory = (char*) malloc (size);
+#endif
+  if (memory == nullptr)
+    throw_or_abort (std::bad_alloc());
+  open_header (true);
+  }
+
+#ifdef ALLOCATOR_HAS_MMAN
+Allocator_region :: Allocator_region (const char* path, size_t size) :
+  sizeof_region (size),
+  file_backed (true)
+  {
+  if (size > (size_t)std::numeric_limits<uint32_t>::max() + 1)
+    throw_or_abort (std::bad_alloc());
+  if (size < sizeof_header)
+    throw_or_abort (std::system_error (EINVAL, std::generic_category(), path));
+
+  auto fd = open (path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    throw_or_abort (std::system_error (errno, std::generic_category(), path));
+  auto fresh = map_file (fd, size);
+  if (!open_header (fresh))
+    {
+    munmap (memory, size);
+    throw_or_abort (std::system_error (EINVAL, std::generic_category(), path));
+    }
+  }
+
+Allocator_region :: Allocator_region (shared_memory_t, const char* name, size_t size, bool read_only) :
+  sizeof_region (size),
+  file_backed (true),
+  writable (!read_only)
+  {
+  if (size > (size_t)std::numeric_limits<uint32_t>::max() + 1)
+    throw_or_abort (std::bad_alloc());
+  if (size < sizeof_header)
+    throw_or_abort (std::system_error (EINVAL, std::generic_category(), name));
+
+  auto fd = read_only ? shm_open (name, O_RDONLY, 0) : shm_open (name, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    throw_or_abort (std::system_error (errno, std::generic_category(), name));
+  auto fresh = map_file (fd, size);
+  if (!open_header (fresh))
+    {
+    munmap (memory, size);
+    throw_or_abort (std::system_error (EINVAL, std::generic_category(), name));
+    }
+  }
+
+void Allocator_region :: unlink_shared (const char* name)
+  { shm_unlink (name); }
+
+bool Allocator_region :: map_file (int fd, size_t size)
+  {
+  struct stat status;
+  auto error = 0;
+  auto fresh = false;
+  if (fstat (fd, &status) < 0)
+    error = errno;
+  else if ((size_t)status.st_size < size)
+    {
+    // A read-only region can't be grown, and would have no header
+    // Any other file is checked before it's touched, so that opening
+    // something else than a region leaves it as it was
+    Header existing;
+    fresh = status.st_size == 0;
+    if (!writable || (!fresh && (pread (fd, &existing, sizeof(existing), 0) != (ssize_t)sizeof(existing) || existing.magic != magic)))
+      error = EINVAL;
+    else if (ftruncate (fd, size) < 0)
+      error = errno;
+    }
+  if (error != 0)
+    {
+    close (fd);
+    throw_or_abort (std::system_error (error, std::generic_category(), "Allocator_region"));
+    }
+
+  auto addr = mmap (nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  error = errno;
+  // The mapping keeps the file open
+  close (fd);
+  if (addr == MAP_FAILED)
+    throw_or_abort (std::system_error (error, std::generic_category(), "Allocator_region"));
+  memory = (char*)addr;
+  return fresh;
+  }
+#endif
+
+Allocator_region :: ~Allocator_region()
+  {
+#ifdef ALLOCATOR_HAS_MMAN
+  munmap (memory, sizeof_region);
+#else
+  free (memory);
+#endif
+  }
+
+bool Allocator_region :: open_header (bool fresh)
+  {
+  if (fresh)
+    *header() = Header {magic, 0, 0};
+  return header()->magic == magic && header()->used <= data_size();
+  }
+
+void Allocator_region :: flush()
+  {
+#ifdef ALLOCATOR_HAS_MMAN
+  if (file_backed && writable)
+    msync (memory, sizeof_region, MS_SYNC);
+#endif
+  }
+
+
+Generic_allocator :: Generic_allocator()
+  {  }
+
+Generic_allocator :: Generic_allocator (size_t first_cache_size, size_t cache_size) :
+  Allocator_base (first_cache_size, cache_size)
+  {  }
+
+Generic_allocator :: ~Generic_allocator()
+  { clear(); }
+
+void Generic_allocator :: clear()
+  {
+  // Every object is destroyed before any cache is freed, as an object may
+  // own memory allocated after it (e.g. the elements of an Arena_vector)
+  for (auto current = cache; current != nullptr; current = current->previous)
+    destroy_objects (current);
+
+  // Delete all Allocator_cache instances, save for the original one
+  while (cache->previous != nullptr)
+    {
+    auto tmp = cache->previous;
+    Allocator_cache::destruct (cache);
+    cache = tmp;
+    }
   // Reset the original instance
-  // The data is not modified, and Objects allocated in the first
-  // cache will remain accessible (to avoid this, we could reallocate or
-  // overwrite the original cache as well, at a small performance cost)
-  cache->cursor = cache->start;
+  // The data is not modified (unless zero_caches is set), and Objects
+  // allocated in the first cache will remain accessible
+  reset_first();
+  }
+
+void Generic_allocator :: parallel_clear (unsigned int threads)
+  {
+  if (threads <= 1)
+    return clear();
+
+  auto caches = list_caches();
+  parallel_for (caches.size(), threads, [&] (size_t i)
+    { destroy_objects (caches[i]); });
+  release_caches (caches, threads);
+  }
+
+void Generic_allocator :: clear_async()
+  {
+  for (auto current = cache; current != nullptr; current = current->previous)
+    destroy_objects (current);
+  Allocator_reclaimer::release (detach_caches());
+  }
+
+// Walks the wrappers backwards, from the newest, see Allocator::destroy_objects()
+void Generic_allocator :: destroy_objects (Allocator_cache* cache)
+  {
+  if (cache->cursor == cache->start)
+    return;
+
+  for (auto pos = cache->last;; pos -= ((Obj_wrapper*)pos)->sizeof_previous)
+    {
+    ((Obj_wrapper*)pos)->~Obj_wrapper();
+    if (pos == cache->start)
+      break;
+    }
+  }
+
+void Generic_allocator :: reserve (size_t bytes)
+  { reserve_cache (bytes); }
+
+void* Generic_allocator :: allocate (size_t bytes)
+  {
+  // sizeof_previous of the next record must be able to hold this one
+  if (bytes > std::numeric_limits<uint32_t>::max() - sizeof_wrapper - alignment)
+    throw_or_abort (std::bad_alloc());
+
+  auto sizeof_block = align_record (sizeof_wrapper + bytes);
+  if ((size_t)((char*)cache->end - cache->cursor) < sizeof_block)
+    reserve_cache (sizeof_block);
+
+  auto tmp = new (cache->cursor) Obj_wrapper ((uint32_t)(cache->cursor - cache->last));
+  cache->last = cache->cursor;
+  cache->cursor += sizeof_block;
+  return tmp->obj_ptr();
+  }
+
+bool Generic_allocator :: extend (void* block, size_t bytes)
+  {
+  if (cache->cursor == cache->start || ((Obj_wrapper*)cache->last)->obj_ptr() != block)
+    return false;
+
+  auto sizeof_extra = align_record (bytes);
+  if ((size_t)((char*)cache->end - cache->cursor) < sizeof_extra
+      || (size_t)(cache->cursor - cache->last) + sizeof_extra > std::numeric_limits<uint32_t>::max())
+    return false;
+
+  cache->cursor += sizeof_extra;
+  return true;
+  }
+
+void Generic_allocator :: splice (Generic_allocator&& other)
+  {
+  if (&other != this)
+    splice_chain (other);
+  }
+
+Arena_string :: Arena_string (Generic_allocator& allocator, std::string_view str) :
+  length (str.size())
+  {
+  auto tmp = (char*) allocator.allocate (str.size() + 1);
+  memcpy (tmp, str.data(), str.size());
+  tmp[str.size()] = '\0';
+  chars = tmp;
+  }
+
+Arena_string :: Arena_string (const char* chars, size_t length) :
+  chars (chars),
+  length (length)
+  {  }
+
+
+String_interner :: String_interner (Generic_allocator& allocator) :
+  allocator (&allocator),
+  slots (16)
+  {  }
+
+Arena_string String_interner :: intern (std::string_view str)
+  {
+  auto hash = std::hash<std::string_view>() (str);
+  auto mask = slots.size() - 1;
+  auto i = hash & mask;
+  for (; slots[i].string.chars != nullptr; i = (i + 1) & mask)
+    if (slots[i].hash == hash && slots[i].string.view() == str)
+      return slots[i].string;
+
+  Arena_string tmp (store (str), str.size());
+  slots[i].hash = hash;
+  slots[i].string = tmp;
+  if (++count * 2 > slots.size())
+    rehash (slots.size() * 2);
+  return tmp;
+  }
+
+const char* String_interner :: store (std::string_view str)
+  {
+  auto needed = str.size() + 1;
+  if ((size_t)(block_end - block_cursor) < needed)
+    {
+    auto sizeof_extra = needed > sizeof_block ? needed : sizeof_block;
+    // Carry on in place if nothing else was allocated since the last block
+    if (block != nullptr && allocator->extend (block, sizeof_extra))
+      block_end += sizeof_extra;
+    else
+      {
+      block = block_cursor = (char*) allocator->allocate (sizeof_extra);
+      block_end = block_cursor + sizeof_extra;
+      }
+    }
+
+  auto tmp = block_cursor;
+  memcpy (tmp, str.data(), str.size());
+  tmp[str.size()] = '\0';
+  block_cursor += needed;
+  return tmp;
   }
 
+void String_interner :: rehash (size_t sizeof_slots)
+  {
+  std::vector<Slot> old (sizeof_slots);
+  old.swap (slots);
+  auto mask = slots.size() - 1;
+  for (auto& slot : old)
+    if (slot.string.chars != nullptr)
+      {
+      auto i = slot.hash & mask;
+      while (slots[i].string.chars != nullptr)
+        i = (i + 1) & mask;
+      slots[i] = slot;
+      }
+  }
+
+
+Obj_wrapper :: Obj_wrapper (uint32_t sizeof_previous) :
+  sizeof_obj (0),
+  sizeof_previous (sizeof_previous),
+  destructor_ptr (nullptr)
+  {  }
+
 Obj_wrapper :: ~Obj_wrapper()
   {
-  (*destructor_ptr) (obj_ptr());
+  if (destructor_ptr != nullptr)
+    (*destructor_ptr) (obj_ptr());
   }
 
 void* Obj_wrapper :: obj_ptr()
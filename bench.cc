@@ -0,0 +1,436 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <list>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#define ALLOCATOR_IMPLEMENTATION
+#include "allocator.h"
+
+using namespace std;
+
+
+// Runs fn repeat times, and returns the best time in nanoseconds per iteration
+template <class Function>
+double measure (Function fn, size_t iterations, int repeat = 5)
+  {
+  double best = 0;
+  for (int i = 0; i < repeat; i++)
+    {
+    auto begin = chrono::steady_clock::now();
+    fn();
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - begin;
+    if (i == 0 || elapsed.count() < best)
+      best = elapsed.count();
+    }
+  return best / iterations;
+  }
+
+void report (const char* name, double ns)
+  { cerr << name << ns << " ns\n"; }
+
+// Keeps the compiler from optimizing away the allocations
+volatile uintptr_t sink;
+
+// create() followed by clear(), with the given allocator type
+template <class Alloc>
+double bench_create (size_t count)
+  {
+  Alloc allocator;
+  return measure ([&]
+    {
+    for (size_t i = 0; i < count; i++)
+      sink = (uintptr_t)allocator.create ((int)i);
+    allocator.clear();
+    }, count);
+  }
+
+// create() alone, into a cache reserved beforehand: the latency of the
+// fast path, with no roll over or destructor involved
+double bench_create_reserved (size_t count)
+  {
+  Allocator<int> allocator;
+  double best = 0;
+  for (int i = 0; i < 5; i++)
+    {
+    allocator.reserve (count);
+
+    auto begin = chrono::steady_clock::now();
+    for (size_t j = 0; j < count; j++)
+      sink = (uintptr_t)allocator.create ((int)j);
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - begin;
+    if (i == 0 || elapsed.count() < best)
+      best = elapsed.count();
+    allocator.clear();
+    }
+  return best / count;
+  }
+
+// Object with a cheap, but non-trivial destructor
+struct Counted_obj
+  {
+  uintptr_t value = 1;
+  ~Counted_obj()
+    { sink = sink + value; }
+  };
+
+// create() followed by clear(), for objects with a non-trivial destructor
+double bench_destructors (size_t count)
+  {
+  Allocator<Counted_obj> allocator;
+  return measure ([&]
+    {
+    for (size_t i = 0; i < count; i++)
+      allocator.create();
+    allocator.clear();
+    }, count);
+  }
+
+// Generic_allocator::create() followed by clear()
+double bench_generic (size_t count)
+  {
+  Generic_allocator allocator;
+  return measure ([&]
+    {
+    for (size_t i = 0; i < count; i++)
+      allocator.create<Counted_obj>();
+    allocator.clear();
+    }, count);
+  }
+
+// Object with a non-trivial destructor, which frees heap memory
+struct Heavy_obj
+  {
+  string data = string (64, 'x');
+  };
+
+// Time to clear() count Heavy_objs, or to parallel_clear() them from
+// the given number of threads; the allocations aren't measured
+double bench_clear (size_t count, unsigned int threads)
+  {
+  Allocator<Heavy_obj> allocator;
+  double best = 0;
+  for (int i = 0; i < 5; i++)
+    {
+    for (size_t j = 0; j < count; j++)
+      allocator.create();
+
+    auto begin = chrono::steady_clock::now();
+    if (threads == 0)
+      allocator.clear();
+    else
+      allocator.parallel_clear (threads);
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - begin;
+    if (i == 0 || elapsed.count() < best)
+      best = elapsed.count();
+    }
+  return best / count;
+  }
+
+// Fills many small vectors one after another, as when building a tree,
+// keeping them until all are released: time per element
+double bench_std_vectors (size_t count, size_t elements)
+  {
+  return measure ([&]
+    {
+    vector<vector<int>> vectors (count / elements);
+    for (auto& vector : vectors)
+      for (size_t j = 0; j < elements; j++)
+        vector.push_back ((int)j);
+    sink = (uintptr_t)vectors.back().data();
+    }, count);
+  }
+
+// Same as bench_std_vectors(), with Arena_vectors in a Generic_allocator
+double bench_arena_vectors (size_t count, size_t elements)
+  {
+  Generic_allocator allocator (1024 * 1024, 1024 * 1024);
+  return measure ([&]
+    {
+    Arena_vector<int>* vector = nullptr;
+    for (size_t i = 0; i < count / elements; i++)
+      {
+      vector = allocator.create<Arena_vector<int>> (allocator);
+      for (size_t j = 0; j < elements; j++)
+        vector->push_back ((int)j);
+      }
+    sink = (uintptr_t)vector->data();
+    allocator.clear();
+    }, count);
+  }
+
+// Identifiers, as a parser would see them: few distinct ones, many repeats
+vector<string> make_identifiers (size_t count, size_t distinct)
+  {
+  vector<string> identifiers;
+  for (size_t i = 0; i < count; i++)
+    identifiers.push_back ("identifier_" + to_string ((i * 7919) % distinct));
+  return identifiers;
+  }
+
+// Deduplicates the identifiers in an unordered_set of std::strings
+double bench_string_set (const vector<string>& identifiers)
+  {
+  return measure ([&]
+    {
+    unordered_set<string> strings;
+    for (auto& identifier : identifiers)
+      sink = (uintptr_t)strings.insert (identifier).first->data();
+    }, identifiers.size());
+  }
+
+// Deduplicates the identifiers with a String_interner
+double bench_interner (const vector<string>& identifiers)
+  {
+  Generic_allocator allocator;
+  return measure ([&]
+    {
+    String_interner interner (allocator);
+    for (auto& identifier : identifiers)
+      sink = (uintptr_t)interner.intern (identifier).data();
+    allocator.clear();
+    }, identifiers.size());
+  }
+
+// Builds many small symbol tables, looking each symbol up once, then
+// discards them: time per symbol
+// Keys are multiples of stride: a power of two gives keys that only
+// differ in their high bits
+double bench_unordered_map (size_t count, size_t symbols, uint64_t stride)
+  {
+  return measure ([&]
+    {
+    for (size_t i = 0; i < count / symbols; i++)
+      {
+      unordered_map<uint64_t, uint64_t> table;
+      for (uint64_t j = 0; j < symbols; j++)
+        table[j * stride] = j;
+      for (uint64_t j = 0; j < symbols; j++)
+        sink = sink + table.find (j * stride)->second;
+      }
+    }, count);
+  }
+
+// Same as bench_unordered_map(), with Arena_hash_maps
+double bench_arena_hash_map (size_t count, size_t symbols, uint64_t stride)
+  {
+  Generic_allocator allocator (64 * 1024, 64 * 1024);
+  return measure ([&]
+    {
+    for (size_t i = 0; i < count / symbols; i++)
+      {
+        {
+        Arena_hash_map<uint64_t, uint64_t> table (allocator);
+        for (uint64_t j = 0; j < symbols; j++)
+          table[j * stride] = j;
+        for (uint64_t j = 0; j < symbols; j++)
+          sink = sink + *table.find (j * stride);
+        }
+      allocator.clear();
+      }
+    }, count);
+  }
+
+// Node of the intrusive containers
+struct Bench_node : List_hook<Bench_node>, Tree_hook<Bench_node>
+  {
+  uint64_t value;
+  Bench_node (uint64_t value) :
+    value (value)
+    {  }
+  bool operator< (const Bench_node& other) const
+    { return value < other.value; }
+  };
+
+// The traversal benchmarks fill several containers at once, round robin,
+// as a program building several structures would: with the default
+// allocator the nodes of each container are interleaved in memory,
+// while each Allocator keeps its nodes together
+// They return the time per node of visiting every container
+
+double bench_std_list (size_t count, size_t lists)
+  {
+  vector<list<uint64_t>> containers (lists);
+  for (size_t i = 0; i < count; i++)
+    containers[i % lists].push_back (i);
+  return measure ([&]
+    {
+    for (auto& container : containers)
+      for (auto value : container)
+        sink = sink + value;
+    }, count);
+  }
+
+double bench_intrusive_list (size_t count, size_t lists)
+  {
+  vector<unique_ptr<Allocator<Bench_node>>> allocators;
+  vector<Intrusive_list<Bench_node>> containers (lists);
+  for (size_t i = 0; i < lists; i++)
+    allocators.emplace_back (new Allocator<Bench_node> (64 * 1024, 64 * 1024));
+  for (size_t i = 0; i < count; i++)
+    containers[i % lists].push_back (*allocators[i % lists]->create (i));
+  return measure ([&]
+    {
+    for (auto& container : containers)
+      for (auto& node : container)
+        sink = sink + node.value;
+    }, count);
+  }
+
+// Keys are inserted in pseudo-random order
+double bench_std_map (size_t count, size_t maps)
+  {
+  vector<map<uint64_t, uint64_t>> containers (maps);
+  for (size_t i = 0; i < count; i++)
+    containers[i % maps].emplace (i * 0x9E3779B97F4A7C15, i);
+  return measure ([&]
+    {
+    for (auto& container : containers)
+      for (auto& entry : container)
+        sink = sink + entry.second;
+    }, count);
+  }
+
+double bench_intrusive_tree (size_t count, size_t maps)
+  {
+  vector<unique_ptr<Allocator<Bench_node>>> allocators;
+  vector<Intrusive_tree<Bench_node>> containers (maps);
+  for (size_t i = 0; i < maps; i++)
+    allocators.emplace_back (new Allocator<Bench_node> (64 * 1024, 64 * 1024));
+  for (size_t i = 0; i < count; i++)
+    containers[i % maps].insert (*allocators[i % maps]->create (i * 0x9E3779B97F4A7C15));
+  return measure ([&]
+    {
+    for (auto& container : containers)
+      container.for_each ([] (Bench_node& node)
+        { sink = sink + node.value; });
+    }, count);
+  }
+
+// Linked list nodes, with a pointer or an Arena_ptr
+struct Pointer_node
+  {
+  uint64_t value;
+  Pointer_node *next;
+  };
+
+struct Offset_node
+  {
+  uint32_t value;
+  Arena_ptr<Offset_node> next;
+  };
+
+// Order in which the nodes are linked, so that following the list jumps
+// around memory
+vector<size_t> shuffled (size_t count)
+  {
+  vector<size_t> order (count);
+  for (size_t i = 0; i < count; i++)
+    order[i] = (i * 7919) % count;
+  return order;
+  }
+
+// Time per node of following a list of count nodes
+double bench_pointer_list (size_t count)
+  {
+  Allocator<Pointer_node> allocator (count * sizeof(Pointer_node));
+  vector<Pointer_node*> nodes;
+  for (size_t i = 0; i < count; i++)
+    nodes.push_back (allocator.create (Pointer_node {i, nullptr}));
+  auto order = shuffled (count);
+  for (size_t i = 0; i + 1 < count; i++)
+    nodes[order[i]]->next = nodes[order[i + 1]];
+  return measure ([&]
+    {
+    for (auto node = nodes[order[0]]; node != nullptr; node = node->next)
+      sink = sink + node->value;
+    }, count);
+  }
+
+double bench_offset_list (size_t count)
+  {
+  Allocator_region region (count * sizeof(Offset_node) + 4096);
+  Region_allocator<Offset_node> allocator (region);
+  vector<Offset_node*> nodes;
+  for (size_t i = 0; i < count; i++)
+    nodes.push_back (allocator.create (Offset_node {(uint32_t)i, {}}));
+  auto order = shuffled (count);
+  for (size_t i = 0; i + 1 < count; i++)
+    nodes[order[i]]->next = Arena_ptr<Offset_node> (region, nodes[order[i + 1]]);
+  return measure ([&]
+    {
+    for (auto node = nodes[order[0]]; node != nullptr; node = node->next.get (region))
+      sink = sink + node->value;
+    }, count);
+  }
+
+// snapshot() of count objects to memory, then restore(): time per object
+double bench_snapshot (size_t count)
+  {
+  Allocator<uint64_t> allocator (64 * 1024, 64 * 1024);
+  for (size_t i = 0; i < count; i++)
+    allocator.create (i);
+  Allocator<uint64_t> restored;
+  return measure ([&]
+    {
+    stringstream image;
+    allocator.snapshot (image);
+    restored.restore (image);
+    }, count);
+  }
+
+int main()
+{
+  constexpr size_t count = 10000000;
+
+  report ("create, runtime cache size :      ", bench_create<Allocator<int>> (count));
+  report ("create, compile-time cache size : ", bench_create<Allocator<int, Allocator_policy<2048>>> (count));
+  report ("create, doubling growth :         ", bench_create<Allocator<int, Allocator_policy<2048, Doubling_growth>>> (count));
+  report ("create, mutex lock :              ", bench_create<Allocator<int, Allocator_policy<2048, Fixed_growth, 0, Mutex_lock>>> (count));
+  report ("create, reserved cache :          ", bench_create_reserved (count));
+
+  report ("create and clear :                ", bench_destructors (count));
+  report ("Generic, create and clear :       ", bench_generic (count));
+
+  report ("std::vector, 20 elements :        ", bench_std_vectors (count, 20));
+  report ("Arena_vector, 20 elements :       ", bench_arena_vectors (count, 20));
+  report ("std::vector, 1000 elements :      ", bench_std_vectors (count, 1000));
+  report ("Arena_vector, 1000 elements :     ", bench_arena_vectors (count, 1000));
+
+  auto identifiers = make_identifiers (1000000, 100000);
+  report ("unordered_set<string> :           ", bench_string_set (identifiers));
+  report ("String_interner :                 ", bench_interner (identifiers));
+
+  report ("unordered_map, 100 symbols :      ", bench_unordered_map (count, 100, 7919));
+  report ("Arena_hash_map, 100 symbols :     ", bench_arena_hash_map (count, 100, 7919));
+  report ("unordered_map, 10000 symbols :    ", bench_unordered_map (count, 10000, 7919));
+  report ("Arena_hash_map, 10000 symbols :   ", bench_arena_hash_map (count, 10000, 7919));
+  report ("unordered_map, strided keys :     ", bench_unordered_map (count, 10000, 4096));
+  report ("Arena_hash_map, strided keys :    ", bench_arena_hash_map (count, 10000, 4096));
+
+  constexpr size_t node_count = 1000000;
+  report ("std::list traversal :             ", bench_std_list (node_count, 8));
+  report ("Intrusive_list traversal :        ", bench_intrusive_list (node_count, 8));
+  report ("std::map traversal :              ", bench_std_map (node_count, 8));
+  report ("Intrusive_tree traversal :        ", bench_intrusive_tree (node_count, 8));
+
+  report ("pointer list, 16 byte nodes :     ", bench_pointer_list (4 * node_count));
+  report ("Arena_ptr list, 8 byte nodes :    ", bench_offset_list (4 * node_count));
+
+  report ("snapshot and restore :            ", bench_snapshot (count));
+
+  constexpr size_t clear_count = 2000000;
+  cerr << "(" << thread::hardware_concurrency() << " hardware threads)\n";
+  report ("clear :                           ", bench_clear (clear_count, 0));
+  report ("parallel_clear, 1 thread :        ", bench_clear (clear_count, 1));
+  report ("parallel_clear, 2 threads :       ", bench_clear (clear_count, 2));
+  report ("parallel_clear, 4 threads :       ", bench_clear (clear_count, 4));
+  report ("parallel_clear, 8 threads :       ", bench_clear (clear_count, 8));
+
+  return 0;
+}
@@ -1,17 +1,28 @@
 #include <iostream>
 #include <assert.h>
 #include <string>
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <sstream>
 
 #define ALLOCATOR_IMPLEMENTATION
 #include "allocator.h"
 
+#ifdef ALLOCATOR_HAS_MMAN
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
 using namespace std;
 
 
 class TestObj
   {
   public:
-  inline static int counter = 0;
+  // Atomic, as the parallel tests destroy objects from multiple threads
+  inline static std::atomic<int> counter = 0;
   int id;
   TestObj() :
     id (++counter)
@@ -67,5 +78,963 @@ int main()
   cerr << "Generic_allocator test : OK\n";
   }
 
+  // Test splicing allocators: objects change owner, nothing is copied
+  {
+  Allocator<TestObj> consumer;
+  TestObj* a;
+    {
+    Allocator<TestObj> producer;
+    a = producer.create();
+    for (int i = 0; i < 1000; i++)
+      producer.create();
+    consumer.create();
+    consumer.splice (std::move (producer));
+    assert (TestObj::counter == 1002);
+    producer.create();
+    assert (TestObj::counter == 1003);
+    }
+  // Objects owned by the destroyed producer are still alive
+  assert (TestObj::counter == 1002);
+  assert (a->id == 1);
+  consumer.create();
+  consumer.clear();
+  assert (TestObj::counter == 0);
+
+  Generic_allocator generic_consumer;
+  Generic_allocator generic_producer;
+  generic_producer.create<TestObj>();
+  generic_consumer.create<int>(1);
+  generic_consumer.splice (std::move (generic_producer));
+  generic_producer.create<TestObj>();
+  generic_producer.clear();
+  assert (TestObj::counter == 1);
+  generic_consumer.clear();
+  assert (TestObj::counter == 0);
+  cerr << "Splice test :            OK\n";
+  }
+
+  // Test allocators that are left empty, or emptied by splice()
+  {
+  Allocator<TestObj> empty;
+  empty.clear();
+  Allocator<TestObj> allocator;
+  allocator.splice (std::move (empty));
+  allocator.create();
+  empty.splice (std::move (allocator));
+  assert (TestObj::counter == 1);
+  allocator.clear();
+  assert (TestObj::counter == 1);
+  empty.clear();
+  assert (TestObj::counter == 0);
+
+  Generic_allocator generic_empty;
+  generic_empty.clear();
+  cerr << "Empty allocator test :   OK\n";
+  }
+
+  // Test Inline_allocator: the first objects live inside the allocator
+  {
+    {
+    Inline_allocator<TestObj, 256> allocator;
+    auto a = allocator.create();
+    assert ((char*)a > (char*)&allocator);
+    assert ((char*)a < (char*)&allocator + sizeof(allocator));
+    for (int i = 0; i < 1000; i++)
+      allocator.create();
+    assert (TestObj::counter == 1001);
+    allocator.clear();
+    assert (TestObj::counter == 0);
+
+    a = allocator.create();
+    assert ((char*)a < (char*)&allocator + sizeof(allocator));
+    Allocator<TestObj> other;
+    other.create();
+    allocator.splice (std::move (other));
+    assert (TestObj::counter == 2);
+    }
+  assert (TestObj::counter == 0);
+  cerr << "Inline_allocator test :  OK\n";
+  }
+
+  // Test compile-time policies
+  {
+  Allocator<int, Allocator_policy<64, Doubling_growth, 16, Mutex_lock>> allocator;
+  int* previous = nullptr;
+  for (int i = 0; i < 1000; i++)
+    {
+    auto a = allocator.create (i);
+    assert ((uintptr_t)a % 16 == 0);
+    if (previous != nullptr)
+      assert (*previous == i - 1);
+    previous = a;
+    }
+  allocator.clear();
+
+  Allocator<TestObj, Allocator_policy<sizeof(TestObj)>> tight;
+  auto a = tight.create();
+  auto b = tight.create();
+  assert (a->id == 1);
+  assert (b->id == 2);
+  tight.clear();
+  assert (TestObj::counter == 0);
+
+  // Caches start on a fresh cache line, so objects can be aligned on one
+  Allocator<int, Allocator_policy<256, Fixed_growth, Allocator_cache::line_size>> lines;
+  for (int i = 0; i < 100; i++)
+    assert ((uintptr_t)lines.create (i) % Allocator_cache::line_size == 0);
+  Inline_allocator<int, 64, Allocator_policy<0, Fixed_growth, Allocator_cache::line_size>> inline_lines;
+  assert ((uintptr_t)inline_lines.create (1) % Allocator_cache::line_size == 0);
+  cerr << "Policy test :            OK\n";
+  }
+
+  // Test runtime cache sizes: a first cache sized to the working set
+  // holds every object
+  {
+  Allocator<int> allocator (100000 * sizeof(int), 64);
+  auto first = allocator.create (0);
+  for (int i = 1; i < 100000; i++)
+    assert (allocator.create (i) == first + i);
+  assert (allocator.create (0) != first + 100000);
+
+  Generic_allocator generic (64, 4096);
+  generic.create<int>();
+  generic.create<TestObj>();
+  generic.clear();
+  assert (TestObj::counter == 0);
+
+#ifdef __cpp_exceptions
+  allocator.cache_size = 2;
+  bool thrown = false;
+  try
+    {
+    for (int i = 0; i < 64; i++)
+      allocator.create (0);
+    }
+  catch (std::bad_alloc&)
+    { thrown = true; }
+  assert (thrown);
+#endif
+  cerr << "Cache size test :        OK\n";
+  }
+
+  // Test reserve(): the reserved objects are allocated contiguously
+  {
+  Allocator<int> allocator;
+  allocator.create (0);
+  allocator.reserve (50000);
+  // Already reserved: the current cache is kept
+  allocator.reserve (50000);
+  auto first = allocator.create (0);
+  for (int i = 1; i < 50000; i++)
+    assert (allocator.create (i) == first + i);
+
+  Generic_allocator generic;
+  generic.reserve<TestObj> (1000);
+  auto a = generic.create<TestObj>();
+  auto b = generic.create<TestObj>();
+  auto step = (char*)b - (char*)a;
+  for (int i = 2; i < 1000; i++)
+    assert ((char*)generic.create<TestObj>() == (char*)a + step * i);
+  generic.clear();
+  assert (TestObj::counter == 0);
+  cerr << "Reserve test :           OK\n";
+  }
+
+  // Test iteration, in allocation order across caches and splices
+  {
+  Allocator<int> allocator;
+  assert (allocator.begin() == allocator.end());
+  for (int i = 0; i < 1000; i++)
+    allocator.create (i);
+  Allocator<int> other;
+  other.reserve (10);
+  for (int i = 1000; i < 2000; i++)
+    other.create (i);
+  allocator.splice (std::move (other));
+
+  int expected = 0;
+  for (auto& i : allocator)
+    assert (i == expected++);
+  assert (expected == 2000);
+
+  expected = 0;
+  allocator.for_each ([&] (int& i)
+    { assert (i == expected++); });
+  assert (expected == 2000);
+
+  expected = 0;
+  allocator.for_each_range ([&] (int* first, int* last)
+    {
+    for (; first != last; first++)
+      assert (*first == expected++);
+    });
+  assert (expected == 2000);
+
+  const auto& const_allocator = allocator;
+  assert (std::distance (const_allocator.begin(), const_allocator.end()) == 2000);
+  allocator.clear();
+  assert (allocator.begin() == allocator.end());
+  cerr << "Iteration test :         OK\n";
+  }
+
+  // Test parallel_for_each: every object is visited exactly once
+  {
+  Allocator<int> allocator;
+  for (int i = 0; i < 10000; i++)
+    allocator.create (0);
+  allocator.reserve (100000);
+  for (int i = 0; i < 100000; i++)
+    allocator.create (0);
+
+  allocator.parallel_for_each ([] (int& i)
+    { i++; }, 4);
+  for (auto i : allocator)
+    assert (i == 1);
+
+  Allocator<int> empty;
+  empty.parallel_for_each ([] (int&)
+    { assert (false); });
+  cerr << "Parallel for_each test : OK\n";
+  }
+
+  // Test parallel_clear(): same result as clear()
+  {
+  Allocator<TestObj> allocator;
+  Generic_allocator generic;
+  for (int i = 0; i < 10000; i++)
+    {
+    allocator.create();
+    generic.create<TestObj>();
+    generic.create<int>();
+    }
+  allocator.parallel_clear (4);
+  generic.parallel_clear (4);
+  assert (TestObj::counter == 0);
+
+  // The allocators are still usable
+  allocator.create();
+  generic.create<TestObj>();
+  assert (TestObj::counter == 2);
+  allocator.parallel_clear (4);
+  generic.parallel_clear (4);
+  assert (TestObj::counter == 0);
+  cerr << "Parallel clear test :    OK\n";
+  }
+
+  // Test clear_async(): destructors are called immediately
+  {
+  Allocator<TestObj> allocator;
+  Generic_allocator generic;
+  for (int i = 0; i < 10000; i++)
+    {
+    allocator.create();
+    generic.create<TestObj>();
+    }
+  allocator.clear_async();
+  generic.clear_async();
+  assert (TestObj::counter == 0);
+
+  allocator.create();
+  assert (allocator.begin()->id == 1);
+  allocator.clear_async();
+  Allocator_reclaimer::drain();
+  cerr << "Async clear test :       OK\n";
+  }
+
+  // Test that clear() destroys objects in reverse allocation order
+  {
+  static int next_id;
+  struct Ordered_obj
+    {
+    int id;
+    Ordered_obj (int id) :
+      id (id)
+      {  }
+    ~Ordered_obj()
+      { assert (id == --next_id); }
+    };
+
+  Allocator<Ordered_obj> allocator;
+  for (next_id = 0; next_id < 10000; next_id++)
+    allocator.create (next_id);
+  allocator.clear();
+  assert (next_id == 0);
+
+  Generic_allocator generic;
+  for (next_id = 0; next_id < 10000; next_id++)
+    {
+    generic.create<Ordered_obj> (next_id);
+    generic.create<char>();
+    }
+  generic.clear();
+  assert (next_id == 0);
+  cerr << "Destruction order test : OK\n";
+  }
+
+  // Test Soa_allocator: each field is stored in its own column
+  {
+  Soa_allocator<std::tuple<int, double, string>, 100> allocator;
+  auto row = allocator.create (1, 2.0, string (100, 'a'));
+  assert (row.get<0>() == 1);
+  assert (row.get<1>() == 2.0);
+  assert (row.get<2>() == string (100, 'a'));
+  for (int i = 2; i <= 1000; i++)
+    {
+    row = allocator.create (i, i * 2.0, string (100, 'a'));
+    assert (row.get<0>() == i);
+    }
+
+  int expected = 1;
+  allocator.for_each_column<0> ([&] (int* first, int* last)
+    {
+    assert (last - first <= 100);
+    for (; first != last; first++)
+      assert (*first == expected++);
+    });
+  assert (expected == 1001);
+  double sum = 0;
+  allocator.for_each_column<1> ([&] (double* first, double* last)
+    {
+    for (; first != last; first++)
+      sum += *first;
+    });
+  assert (sum == 1000 * 1001);
+
+  allocator.clear();
+  row = allocator.create();
+  assert (row.get<0>() == 0);
+  assert (row.get<2>().empty());
+
+  Soa_allocator<std::tuple<char, TestObj>> objects;
+  for (int i = 0; i < 5000; i++)
+    assert (objects.create().get<1>().id == i + 1);
+  objects.clear();
+  assert (TestObj::counter == 0);
+  cerr << "Soa_allocator test :     OK\n";
+  }
+
+  // Test zero_caches: created objects see zeroed memory, even after clear()
+  {
+  // Leaves its value uninitialized
+  struct Raw_obj
+    {
+    int value;
+    Raw_obj()
+      {  }
+    };
+
+  Allocator<Raw_obj> allocator;
+  allocator.zero_caches = true;
+  for (int i = 0; i < 10000; i++)
+    {
+    auto obj = allocator.create();
+    assert (obj->value == 0);
+    obj->value = i + 1;
+    }
+  allocator.clear();
+  for (int i = 0; i < 10000; i++)
+    assert (allocator.create()->value == 0);
+
+  // Nor is the memory left behind by compact()
+  Allocator<Raw_obj> compacted;
+  compacted.zero_caches = true;
+  vector<Raw_obj*> objects;
+  for (int i = 0; i < 64; i++)
+    {
+    objects.push_back (compacted.create());
+    objects.back()->value = i + 1;
+    }
+  for (int i = 0; i < 64; i += 2)
+    compacted.destroy (objects[i]);
+  compacted.compact ([] (Raw_obj*, Raw_obj*) {  });
+  for (int i = 0; i < 32; i++)
+    assert (compacted.create()->value == 0);
+
+  Inline_allocator<Raw_obj, 16> inline_allocator (true);
+  for (int i = 0; i < 100; i++)
+    {
+    auto obj = inline_allocator.create();
+    assert (obj->value == 0);
+    obj->value = i + 1;
+    }
+  inline_allocator.clear();
+  assert (inline_allocator.create()->value == 0);
+
+  Soa_allocator<std::tuple<char, Raw_obj>, 100> soa;
+  soa.zero_caches = true;
+  for (int i = 0; i < 50; i++)
+    soa.create().get<1>().value = i + 1;
+  soa.clear();
+  assert (soa.create().get<1>().value == 0);
+  cerr << "Zero fill test :         OK\n";
+  }
+
+  // Test Arena_vector: storage grows in place while it's the newest allocation
+  {
+  Generic_allocator allocator (64 * 1024, 64 * 1024);
+  Arena_vector<int> ints (allocator);
+  ints.push_back (0);
+  auto data = ints.data();
+  for (int i = 1; i < 1000; i++)
+    ints.push_back (i);
+  assert (ints.data() == data);
+  assert (ints.size() == 1000);
+  for (int i = 0; i < 1000; i++)
+    assert (ints[i] == i);
+
+  // Another allocation in between forces a copy
+  allocator.create<int> (0);
+  ints.reserve (ints.capacity() + 1);
+  assert (ints.data() != data);
+  int expected = 0;
+  for (auto i : ints)
+    assert (i == expected++);
+
+  // Storage bigger than the caches
+  Arena_vector<int> big (allocator);
+  for (int i = 0; i < 100000; i++)
+    big.push_back (i);
+  assert (big.back() == 99999);
+
+  // Destroyed by the allocator, after the caches holding their elements
+  // TestObj counts its copies wrong, so none must be made
+  auto objects = allocator.create<Arena_vector<TestObj>> (allocator);
+  objects->reserve (10000);
+  for (int i = 0; i < 10000; i++)
+    objects->emplace_back();
+  objects->pop_back();
+  assert (TestObj::counter == 9999);
+  allocator.clear();
+  assert (TestObj::counter == 0);
+  cerr << "Arena_vector test :      OK\n";
+  }
+
+  // Test Arena_string and String_interner
+  {
+  Generic_allocator allocator;
+  string source = "identifier";
+  Arena_string copy (allocator, source);
+  source[0] = 'X';
+  assert (copy.view() == "identifier");
+  assert (strlen (copy.c_str()) == copy.size());
+  assert (Arena_string().empty());
+
+  String_interner interner (allocator);
+  auto a = interner.intern ("alpha");
+  auto b = interner.intern (string ("al") + "pha");
+  assert (a.data() == b.data());
+  assert (interner.intern ("beta").data() != a.data());
+  assert (interner.intern ("").empty());
+
+  // Enough strings to rehash, and to fill several blocks
+  vector<const char*> interned;
+  for (int i = 0; i < 10000; i++)
+    interned.push_back (interner.intern (to_string (i) + string (i % 50, 'x')).data());
+  for (int i = 0; i < 10000; i++)
+    {
+    auto str = interner.intern (to_string (i) + string (i % 50, 'x'));
+    assert (str.data() == interned[i]);
+    assert (str.c_str()[str.size()] == '\0');
+    }
+  assert (interner.size() == 10003);
+  assert (interner.intern ("alpha") == a);
+  cerr << "String interning test :  OK\n";
+  }
+
+  // Test Arena_hash_map
+  {
+  Generic_allocator allocator;
+  Arena_hash_map<int, int> squares (allocator);
+  assert (squares.find (1) == nullptr);
+  for (int i = 0; i < 10000; i++)
+    assert (squares.emplace (i, i * i).second);
+  assert (!squares.emplace (5, 0).second);
+  assert (squares.size() == 10000);
+  for (int i = 0; i < 10000; i++)
+    assert (*squares.find (i) == i * i);
+  assert (squares.find (-1) == nullptr);
+  long sum = 0;
+  squares.for_each ([&] (const int& key, int& value)
+    {
+    assert (value == key * key);
+    sum += key;
+    });
+  assert (sum == 9999L * 10000 / 2);
+
+  // Finding a key, even with operator[], never moves the entries
+  Arena_hash_map<long, int> strided (allocator);
+  for (long i = 0; i < 8; i++)
+    strided[i * 4096] = (int)i;
+  auto first = strided.find (0);
+  for (long i = 0; i < 8; i++)
+    assert (strided[i * 4096] == i);
+  assert (&strided[0] == first);
+  for (long i = 8; i < 20000; i++)
+    strided[i * 4096] = (int)i;
+  for (long i = 0; i < 20000; i++)
+    assert (*strided.find (i * 4096) == i);
+
+  auto symbols = allocator.create<Arena_hash_map<string, TestObj*>> (allocator);
+  symbols->reserve (1000);
+  Allocator<TestObj> objects;
+  for (int i = 0; i < 1000; i++)
+    (*symbols)["symbol" + to_string (i)] = objects.create();
+  assert ((*symbols)["symbol10"]->id == 11);
+  assert (symbols->size() == 1000);
+  objects.clear();
+  allocator.clear();
+  assert (TestObj::counter == 0);
+  cerr << "Arena_hash_map test :    OK\n";
+  }
+
+  // Test the intrusive containers, on objects of an Allocator
+  {
+  struct Node : Slist_hook<Node>, List_hook<Node>, Tree_hook<Node>
+    {
+    int value;
+    Node (int value) :
+      value (value)
+      {  }
+    bool operator< (const Node& other) const
+      { return value < other.value; }
+    };
+  auto height_of = [] (Node* node)
+    { return node != nullptr ? node->height : 0; };
+
+  Allocator<Node> allocator;
+  Intrusive_slist<Node> stack;
+  Intrusive_list<Node> list;
+  Intrusive_tree<Node> tree;
+  for (int i = 0; i < 1000; i++)
+    {
+    auto node = allocator.create ((i * 7919) % 1000);
+    stack.push_front (*node);
+    list.push_back (*node);
+    assert (tree.insert (*node) == node);
+    }
+  auto duplicate = allocator.create (5);
+  assert (tree.insert (*duplicate) != duplicate);
+  assert (tree.size() == 1000);
+
+  int expected = 999;
+  for (auto& node : stack)
+    assert (node.value == (expected-- * 7919) % 1000);
+  assert (stack.pop_front()->value == (999 * 7919) % 1000);
+  while (!stack.empty())
+    stack.pop_front();
+  assert (stack.pop_front() == nullptr);
+
+  expected = 0;
+  for (auto& node : list)
+    assert (node.value == (expected++ * 7919) % 1000);
+  assert (list.size() == 1000);
+  list.erase (*list.front());
+  list.erase (*list.back());
+  assert (list.size() == 998);
+  assert (list.front()->value == 7919 % 1000);
+
+  expected = 0;
+  int height = 0;
+  tree.for_each ([&] (Node& node)
+    {
+    assert (node.value == expected++);
+    height = max (height, node.height);
+    });
+  assert (expected == 1000);
+  // An AVL tree of 1000 objects is at most 1.44 * log2 (1000) high
+  assert (height <= 14);
+  assert (tree.find (Node (500))->value == 500);
+  assert (tree.find (Node (1000)) == nullptr);
+
+  // Erasing the odd values keeps the tree ordered and balanced
+  for (int i = 1; i < 1000; i += 2)
+    tree.erase (*tree.find (Node (i)));
+  assert (tree.size() == 500);
+  assert (tree.find (Node (501)) == nullptr);
+  expected = 0;
+  for (auto& node : tree)
+    {
+    assert (node.value == expected);
+    expected += 2;
+    }
+  assert (expected == 1000);
+  height = 0;
+  tree.for_each ([&] (Node& node)
+    {
+    assert (abs (height_of (node.left) - height_of (node.right)) <= 1);
+    height = max (height, node.height);
+    });
+  assert (height <= 13);
+  for (int i = 0; i < 1000; i += 2)
+    tree.erase (*tree.find (Node (i)));
+  assert (tree.empty() && tree.begin() == tree.end());
+  cerr << "Intrusive test :         OK\n";
+  }
+
+  // Test Region_allocator and Arena_ptr
+  {
+  struct Node
+    {
+    int value;
+    Arena_ptr<Node> next;
+    };
+  static_assert (sizeof(Node) == 8);
+
+  Allocator_region region (1024 * 1024);
+  Region_allocator<Node> allocator (region);
+  Arena_ptr<Node> head;
+  assert (!head && head.get (region) == nullptr);
+  for (int i = 0; i < 1000; i++)
+    {
+    auto node = allocator.create();
+    node->value = i;
+    node->next = head;
+    head = Arena_ptr<Node> (region, node);
+    assert ((char*)node >= region.base() && (char*)node < region.base() + region.size());
+    }
+  int expected = 999;
+  for (auto node = head.get (region); node != nullptr; node = node->next.get (region))
+    assert (node->value == expected--);
+  assert (expected == -1);
+
+#ifdef __cpp_exceptions
+  // The region can't grow
+  bool full = false;
+  try
+    {
+    for (int i = 0; i < 1024 * 1024; i++)
+      allocator.create();
+    }
+  catch (std::bad_alloc&)
+    { full = true; }
+  assert (full);
+
+  // Nor be smaller than its header
+  bool small = false;
+  try
+    { Allocator_region tiny (16); }
+  catch (std::bad_alloc&)
+    { small = true; }
+  assert (small);
+#endif
+  allocator.clear();
+  assert (allocator.create() == head.get (region) - 999);
+  cerr << "Region_allocator test :  OK\n";
+  }
+
+  // Test handles
+  {
+  Allocator<int, Allocator_policy<0, Doubling_growth>> allocator;
+  using Handle = decltype(allocator)::Handle;
+  vector<Handle> handles;
+  for (int i = 0; i < 10000; i++)
+    {
+    handles.push_back (allocator.create_handle (i));
+    // Plain create() calls can be mixed in
+    allocator.create (-1);
+    }
+  allocator.reserve (10000);
+  for (int i = 10000; i < 20000; i++)
+    handles.push_back (allocator.create_handle (i));
+  for (int i = 0; i < 20000; i++)
+    assert (*allocator.get (handles[i]) == i);
+
+  decltype(allocator) other;
+  auto other_handle = other.create_handle (-2);
+  allocator.splice (std::move (other));
+  handles.push_back (allocator.create_handle (20000));
+  for (int i = 0; i <= 20000; i++)
+    assert (*allocator.get (handles[i]) == i);
+  assert (other.create_handle (-3).index == other_handle.index);
+
+  allocator.clear();
+  assert (allocator.create_handle (0).index == 0);
+  cerr << "Handle test :            OK\n";
+  }
+
+  // Test destroy() and compact()
+  {
+  Allocator<int> allocator (400, 400);
+  vector<int*> objects;
+  for (int i = 0; i < 1000; i++)
+    objects.push_back (allocator.create (i));
+  for (int i = 0; i < 1000; i++)
+    if (i % 10 != 0)
+      allocator.destroy (objects[i]);
+
+  int expected = 0;
+  for (auto i : allocator)
+    {
+    assert (i == expected);
+    expected += 10;
+    }
+  assert (expected == 1000);
+  int ranges = 0;
+  allocator.for_each_range ([&] (int* first, int* last)
+    {
+    assert (last - first == 1);
+    ranges++;
+    });
+  assert (ranges == 100);
+
+  allocator.compact ([&] (int* from, int* to)
+    {
+    assert (*to == *from);
+    objects[*to] = to;
+    });
+  expected = 0;
+  allocator.for_each_range ([&] (int* first, int* last)
+    {
+    // The 100 remaining objects fit in the first cache
+    assert (last - first == 100);
+    for (; first != last; first++)
+      {
+      assert (*first == expected);
+      assert (objects[expected] == first);
+      expected += 10;
+      }
+    });
+  assert (expected == 1000);
+  assert (*allocator.create (1000) == 1000);
+
+  Allocator<TestObj> test_objects;
+  vector<TestObj*> pointers;
+  for (int i = 0; i < 1000; i++)
+    pointers.push_back (test_objects.create());
+  for (int i = 0; i < 1000; i += 2)
+    test_objects.destroy (pointers[i]);
+  assert (TestObj::counter == 500);
+  test_objects.destroy (&*test_objects.begin());
+  assert (TestObj::counter == 499);
+  test_objects.clear();
+  assert (TestObj::counter == 0);
+
+  // Objects owning memory are moved, not copied
+  Allocator<string> strings;
+  vector<string*> string_pointers;
+  for (int i = 0; i < 1000; i++)
+    string_pointers.push_back (strings.create (100, 'a' + i % 26));
+  for (int i = 0; i < 1000; i += 2)
+    strings.destroy (string_pointers[i]);
+  strings.compact ([] (string*, string* to)
+    { assert (to->size() == 100); });
+  expected = 1;
+  for (auto& str : strings)
+    {
+    assert (str == string (100, 'a' + expected % 26));
+    expected += 2;
+    }
+  assert (expected == 1001);
+  cerr << "Compaction test :        OK\n";
+  }
+
+  // Test snapshot() and restore()
+  {
+  struct Point
+    {
+    double x;
+    double y;
+    };
+
+  Allocator<Point> allocator;
+  vector<Point*> points;
+  for (int i = 0; i < 10000; i++)
+    points.push_back (allocator.create (Point {(double)i, i * 2.0}));
+  for (int i = 0; i < 10000; i += 3)
+    allocator.destroy (points[i]);
+
+  stringstream image;
+  allocator.snapshot (image);
+  Allocator<Point> restored;
+  restored.create (Point {-1, -1});
+  assert (restored.restore (image));
+  int expected = 1;
+  for (auto& point : restored)
+    {
+    assert (point.x == expected && point.y == expected * 2.0);
+    expected += expected % 3 == 2 ? 2 : 1;
+    }
+  assert (expected == 10000);
+  // Restored in a single cache
+  int ranges = 0;
+  restored.for_each_range ([&] (Point*, Point*)
+    { ranges++; });
+  assert (ranges == 1);
+
+  stringstream truncated (image.str().substr (0, 100));
+  assert (!restored.restore (truncated));
+  assert (restored.begin() == restored.end());
+  stringstream garbage ("not an image, but long enough for a header");
+  assert (!restored.restore (garbage));
+  // A count far beyond the objects is caught before allocating them
+  auto bogus_image = image.str();
+  uint64_t bogus_count = uint64_t (1) << 57;
+  memcpy (&bogus_image[16], &bogus_count, sizeof(bogus_count));
+  stringstream bogus (bogus_image);
+  assert (!restored.restore (bogus));
+
+  // Same, from streams that can't seek, read in chunks
+  struct Pipe_buffer : stringbuf
+    {
+    using stringbuf::stringbuf;
+    pos_type seekoff (off_type, ios_base::seekdir, ios_base::openmode) override
+      { return pos_type (-1); }
+    };
+  Pipe_buffer bogus_pipe (bogus_image);
+  istream bogus_in (&bogus_pipe);
+  assert (!restored.restore (bogus_in));
+  assert (restored.begin() == restored.end());
+  Pipe_buffer pipe (image.str());
+  istream in (&pipe);
+  assert (restored.restore (in));
+  expected = 1;
+  for (auto& point : restored)
+    {
+    assert (point.x == expected && point.y == expected * 2.0);
+    expected += expected % 3 == 2 ? 2 : 1;
+    }
+  assert (expected == 10000);
+  cerr << "Snapshot test :          OK\n";
+  }
+
+#ifdef ALLOCATOR_HAS_MMAN
+  // Test file-backed regions: the objects are found again when reopening
+  {
+  struct Node
+    {
+    int value;
+    Arena_ptr<Node> next;
+    };
+
+  char path[] = "/tmp/allocator_test_XXXXXX";
+  close (mkstemp (path));
+    {
+    Allocator_region region (path, 1024 * 1024);
+    Region_allocator<Node> allocator (region);
+    Arena_ptr<Node> head;
+    for (int i = 0; i < 1000; i++)
+      head = Arena_ptr<Node> (region, allocator.create (Node {i, head}));
+    }
+#ifdef __cpp_exceptions
+    {
+    // The objects can only be reopened as objects of the same size
+    struct Big
+      {
+      int values[3];
+      };
+    Allocator_region region (path, 1024 * 1024);
+    bool rejected = false;
+    try
+      { Region_allocator<Big> allocator (region); }
+    catch (std::system_error& error)
+      { rejected = error.code().value() == EINVAL; }
+    assert (rejected);
+    }
+#endif
+    {
+    // Most likely mapped at another address than the first time
+    Allocator_region other (1024 * 1024);
+    Allocator_region region (path, 1024 * 1024);
+    Region_allocator<Node> allocator (region);
+    int expected = 0;
+    for (auto& node : allocator)
+      {
+      assert (node.value == expected);
+      if (expected > 0)
+        assert (node.next.get (region)->value == expected - 1);
+      expected++;
+      }
+    assert (expected == 1000);
+    allocator.create (Node {1000, {}});
+    allocator.sync();
+    assert (region.used() == 1001 * sizeof(Node));
+    allocator.clear();
+    }
+    {
+    Allocator_region region (path, 1024 * 1024);
+    Region_allocator<Node> allocator (region);
+    assert (allocator.begin() == allocator.end());
+    }
+
+#ifdef __cpp_exceptions
+  // Other files are rejected, and left untouched
+  auto text = fopen (path, "w");
+  fputs ("Not a region, just a few words\n", text);
+  fclose (text);
+  bool rejected = false;
+  try
+    { Allocator_region region (path, 1024 * 1024); }
+  catch (std::system_error& error)
+    { rejected = error.code().value() == EINVAL; }
+  assert (rejected);
+  struct stat status;
+  stat (path, &status);
+  assert (status.st_size == 31);
+#endif
+  unlink (path);
+  cerr << "File region test :       OK\n";
+  }
+
+  // Test shared regions: a child process maps the objects built by its parent
+  {
+  struct Node
+    {
+    int value;
+    Arena_ptr<Node> next;
+    };
+
+  auto name = "/allocator_test_" + to_string (getpid());
+  Allocator_region region (Allocator_region::shared_memory, name.c_str(), 1024 * 1024);
+  Region_allocator<Node> allocator (region);
+  Arena_ptr<Node> head;
+  for (int i = 0; i < 1000; i++)
+    head = Arena_ptr<Node> (region, allocator.create (Node {i, head}));
+  allocator.sync();
+
+  auto pid = fork();
+  if (pid == 0)
+    {
+    Allocator_region shared (Allocator_region::shared_memory, name.c_str(), 1024 * 1024, true);
+    Region_allocator<Node> reader (shared);
+    // Same links, followed from another mapping
+    int expected = 999;
+    for (auto node = head.get (shared); node != nullptr; node = node->next.get (shared))
+      if (node->value != expected--)
+        _exit (1);
+    int count = 0;
+    for (auto& node : reader)
+      count += node.value == count;
+#ifdef __cpp_exceptions
+    // Nothing can be added to the producer's objects
+    try
+      {
+      reader.create();
+      _exit (1);
+      }
+    catch (std::bad_alloc&)
+      {  }
+    // Nor can they be cleared, to make room
+    reader.zero_caches = true;
+    reader.clear();
+    try
+      {
+      reader.create();
+      _exit (1);
+      }
+    catch (std::bad_alloc&)
+      {  }
+#endif
+    for (auto& node : reader)
+      count += node.value == count - 1000;
+    _exit (expected == -1 && count == 2000 ? 0 : 1);
+    }
+  int status;
+  waitpid (pid, &status, 0);
+  assert (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+  Allocator_region::unlink_shared (name.c_str());
+  cerr << "Shared region test :     OK\n";
+  }
+#endif
+
   return 0;
 }